@@ -4,10 +4,33 @@ import serial
 from tqdm import tqdm
 import sys
 import os
+import struct
+import time
+import json
+import csv
+import multiprocessing
 
 serial_port = None
+profile = None
+attach_mode = None  # None to reset the target, otherwise whether to halt
+latencies = None  # when benchmarking, the time each response took
 
 FLASH_SECTOR_SIZE = 4096
+FLASH_PAGE_SIZE = 256
+
+# The erase commands for each size of area the flash chip can erase at once.
+FLASH_ERASE_COMMANDS = {4096: 0x20, 32 * 1024: 0x52, 64 * 1024: 0xD8}
+
+PROFILE_FIELDS = [
+    "socid",
+    "ram_start",
+    "ram_size",
+    "flash_size",
+    "calibration_address",
+    "reg_spi_data",
+    "reg_spi_ctrl",
+    "reg_swire_id",
+]
 
 
 def readchar():
@@ -22,6 +45,7 @@ def readchar():
 
 
 def readhex():
+    start = time.perf_counter()
     h = bytearray()
     while True:
         c = readchar()
@@ -30,22 +54,35 @@ def readhex():
         if c == b"S":
             break
         h.append(c[0])
+    if latencies is not None:
+        latencies.append(time.perf_counter() - start)
     return bytes.fromhex(str(h, "ascii"))
 
 
 def connect():
-    serial_port.write(b"i")
+    if attach_mode is None:
+        serial_port.write(b"i")
+    else:
+        serial_port.write(b"a1" if attach_mode else b"a0")
     c = readchar()
     if c != b"S":
         raise BaseException("Connection failed")
 
+    global profile
+    serial_port.write(b"p")
+    h = readhex()
+    profile = {
+        k: int.from_bytes(h[i * 4 : i * 4 + 4], byteorder="big")
+        for i, k in enumerate(PROFILE_FIELDS)
+    }
+
 
 def run():
     serial_port.write(b"g")
 
 
 def read_bytes_from_target(addr, len):
-    s = b"R%04x%04x" % (addr, len)
+    s = b"R%08x%08x" % (addr, len)
     serial_port.write(s)
     return readhex()
 
@@ -63,7 +100,7 @@ def read_quad_from_target(addr):
 
 
 def write_bytes_to_target(addr, bytes):
-    serial_port.write(b"W%04x%04x" % (addr, len(bytes)))
+    serial_port.write(b"W%08x%08x" % (addr, len(bytes)))
     for b in bytes:
         serial_port.write(b"%02x" % b)
     readhex()
@@ -81,45 +118,61 @@ def write_quad_to_target(addr, quad):
     write_bytes_to_target(addr, quad.to_bytes(4, "little"))
 
 
+def write_spi_ctrl(byte):
+    write_byte_to_target(profile["reg_spi_ctrl"], byte)
+
+
+def write_spi_data(byte):
+    write_byte_to_target(profile["reg_spi_data"], byte)
+
+
+def read_spi_data():
+    return read_byte_from_target(profile["reg_spi_data"])
+
+
+def write_swire_id(byte):
+    write_byte_to_target(profile["reg_swire_id"], byte)
+
+
 def read_flash_status():
-    write_byte_to_target(0x0D, 0x00)  # flash CS enable
-    write_byte_to_target(0x0C, 0x03)  # read flash command
+    write_spi_ctrl(0x00)  # flash CS enable
+    write_spi_data(0x03)  # read flash command
 
-    write_byte_to_target(0x0C, 0xFF)
-    byte = read_byte_from_target(0x0C)
+    write_spi_data(0xFF)
+    byte = read_spi_data()
 
-    write_byte_to_target(0x0D, 0x01)  # flash CS disable
+    write_spi_ctrl(0x01)  # flash CS disable
 
     return byte
 
 
 def read_flash_block(addr, len):
-    write_byte_to_target(0x0D, 0x00)  # flash CS enable
-    write_byte_to_target(0x0C, 0x03)  # read flash command
-    write_byte_to_target(0x0C, (addr >> 16) & 0xFF)
-    write_byte_to_target(0x0C, (addr >> 8) & 0xFF)
-    write_byte_to_target(0x0C, addr & 0xFF)
+    write_spi_ctrl(0x00)  # flash CS enable
+    write_spi_data(0x03)  # read flash command
+    write_spi_data((addr >> 16) & 0xFF)
+    write_spi_data((addr >> 8) & 0xFF)
+    write_spi_data(addr & 0xFF)
 
-    write_byte_to_target(0xB3, 0x80)  # SWS to FIFO mode
+    write_swire_id(0x80)  # SWS to FIFO mode
 
     data = bytearray()
     for i in range(0, len):
-        write_byte_to_target(0x0C, 0xFF)
-        data.append(read_byte_from_target(0x0C))
+        write_spi_data(0xFF)
+        data.append(read_spi_data())
 
-    write_byte_to_target(0xB3, 0x00)  # SWS to RAM mode
-    write_byte_to_target(0x0D, 0x01)  # flash CS disable
+    write_swire_id(0x00)  # SWS to RAM mode
+    write_spi_ctrl(0x01)  # flash CS disable
 
     return data
 
 
 def wait_for_flash_chip():
     while True:
-        write_byte_to_target(0x0D, 0x00)  # flash CS enable
-        write_byte_to_target(0x0C, 0x05)  # read_status_command
-        write_byte_to_target(0x0C, 0xFF)  # dummy
-        s = read_byte_from_target(0x0C)
-        write_byte_to_target(0x0D, 0x01)  # flash CS disable
+        write_spi_ctrl(0x00)  # flash CS enable
+        write_spi_data(0x05)  # read_status_command
+        write_spi_data(0xFF)  # dummy
+        s = read_spi_data()
+        write_spi_ctrl(0x01)  # flash CS disable
 
         if s & 0x20:
             raise BaseException("flash write failed")
@@ -127,36 +180,36 @@ def wait_for_flash_chip():
             break
 
 
-def erase_flash_sector(addr):
-    write_byte_to_target(0x0D, 0x00)  # flash CS enable
-    write_byte_to_target(0x0C, 0x06)  # write enable command
-    write_byte_to_target(0x0D, 0x01)  # flash CS disable
+def erase_flash_sector(addr, size=FLASH_SECTOR_SIZE):
+    write_spi_ctrl(0x00)  # flash CS enable
+    write_spi_data(0x06)  # write enable command
+    write_spi_ctrl(0x01)  # flash CS disable
 
-    write_byte_to_target(0x0D, 0x00)  # flash CS enable
-    write_byte_to_target(0x0C, 0x20)  # erase flash sector command
-    write_byte_to_target(0x0C, (addr >> 16) & 0xFF)
-    write_byte_to_target(0x0C, (addr >> 8) & 0xFF)
-    write_byte_to_target(0x0C, addr & 0xFF)
-    write_byte_to_target(0x0D, 0x01)  # flash CS disable
+    write_spi_ctrl(0x00)  # flash CS enable
+    write_spi_data(FLASH_ERASE_COMMANDS[size])  # erase sector/block command
+    write_spi_data((addr >> 16) & 0xFF)
+    write_spi_data((addr >> 8) & 0xFF)
+    write_spi_data(addr & 0xFF)
+    write_spi_ctrl(0x01)  # flash CS disable
 
     wait_for_flash_chip()
 
 
 def write_flash_block(addr, block):
-    write_byte_to_target(0x0D, 0x00)  # flash CS enable
-    write_byte_to_target(0x0C, 0x06)  # write enable command
-    write_byte_to_target(0x0D, 0x01)  # flash CS disable
+    write_spi_ctrl(0x00)  # flash CS enable
+    write_spi_data(0x06)  # write enable command
+    write_spi_ctrl(0x01)  # flash CS disable
 
-    write_byte_to_target(0x0D, 0x00)  # flash CS enable
-    write_byte_to_target(0x0C, 0x02)  # write flash command
-    write_byte_to_target(0x0C, (addr >> 16) & 0xFF)
-    write_byte_to_target(0x0C, (addr >> 8) & 0xFF)
-    write_byte_to_target(0x0C, addr & 0xFF)
+    write_spi_ctrl(0x00)  # flash CS enable
+    write_spi_data(0x02)  # write flash command
+    write_spi_data((addr >> 16) & 0xFF)
+    write_spi_data((addr >> 8) & 0xFF)
+    write_spi_data(addr & 0xFF)
 
     for b in block:
-        write_byte_to_target(0x0C, b)
+        write_spi_data(b)
 
-    write_byte_to_target(0x0D, 0x01)  # flash CS disable
+    write_spi_ctrl(0x01)  # flash CS disable
 
     wait_for_flash_chip()
 
@@ -188,16 +241,27 @@ def hexdump(bytes, address):
         a += 1
 
 
+def ram_defaults(args):
+    if args.address is None:
+        args.address = profile["ram_start"]
+    if args.length is None:
+        args.length = profile["ram_size"]
+
+
 def dump_ram_main(args):
     connect()
     b = read_bytes_from_target(args.address, args.length)
     hexdump(b, args.address)
 
 
+def read_soc_id():
+    serial_port.write(b"s")
+    return int.from_bytes(readhex(), byteorder="big")
+
+
 def get_soc_id_main(args):
     connect()
-    b = read_word_from_target(0x007E)
-    print("SOC ID: 0x%04x\n" % b)
+    print("SOC ID: 0x%04x\n" % read_soc_id())
 
 
 def flash_status_main(arg):
@@ -208,8 +272,9 @@ def flash_status_main(arg):
 
 def read_ram_main(args):
     connect()
+    ram_defaults(args)
     print(
-        "Reading RAM from 0x%04x-0x%04x into '%s':"
+        "Reading RAM from 0x%08x-0x%08x into '%s':"
         % (args.address, args.address + args.length, args.filename)
     )
     with open(args.filename, "wb") as file:
@@ -238,15 +303,37 @@ def read_flash_main(args):
             file.write(b)
 
 
+def calibration_sector():
+    return profile["calibration_address"] & ~(FLASH_SECTOR_SIZE - 1)
+
+
+def skip_calibration_sector(addresses, args, log=print):
+    """Removes anything in the factory calibration sector from the list of
+    flash addresses, unless asked not to."""
+    if args.overwrite_calibration:
+        return addresses
+
+    sector = calibration_sector()
+    kept = [a for a in addresses if (a & ~(FLASH_SECTOR_SIZE - 1)) != sector]
+    if len(kept) != len(addresses):
+        log(
+            "Skipping the factory calibration sector at 0x%08x "
+            "(use --overwrite-calibration to write it anyway)" % sector
+        )
+    return kept
+
+
 def do_erase_flash(args):
+    sectors = skip_calibration_sector(
+        range(args.address, args.address + args.length, FLASH_SECTOR_SIZE),
+        args,
+    )
     print(
         "Erasing flash from 0x%08x-0x%08x:"
         % (args.address, args.address + args.length)
     )
     for base in tqdm(
-        iterable=range(
-            args.address, args.address + args.length, FLASH_SECTOR_SIZE
-        ),
+        iterable=sectors,
         unit_scale=FLASH_SECTOR_SIZE,
         unit="B",
     ):
@@ -255,40 +342,540 @@ def do_erase_flash(args):
 
 def erase_flash_main(args):
     connect()
-    do_erase_flash()
+    do_erase_flash(args)
+
+
+def load_elf(data):
+    """Returns the loadable segments of an ELF file as (address, bytes)."""
+    if data[4] == 1:
+        ehdr = "<16xHHIIIIIHHHHHH"
+        phdr = "<IIIIIIII"
+    else:
+        ehdr = "<16xHHIQQQIHHHHHH"
+        phdr = "<IIQQQQQQ"
+    if data[5] != 1:
+        raise BaseException("only little-endian ELF files are supported")
+
+    fields = struct.unpack_from(ehdr, data)
+    phoff, phentsize, phnum = fields[4], fields[8], fields[9]
+
+    segments = []
+    for i in range(phnum):
+        ph = struct.unpack_from(phdr, data, phoff + i * phentsize)
+        if data[4] == 1:
+            p_type, p_offset, _, p_paddr, p_filesz = ph[:5]
+        else:
+            p_type, _, p_offset, _, p_paddr, p_filesz = ph[:6]
+
+        PT_LOAD = 1
+        if (p_type == PT_LOAD) and p_filesz:
+            segments += [(p_paddr, data[p_offset : p_offset + p_filesz])]
+    return segments
+
+
+def load_ihex(data):
+    """Returns the data records of an Intel HEX file as (address, bytes)."""
+    segments = []
+    base = 0
+    for line in str(data, "ascii").splitlines():
+        line = line.strip()
+        if not line:
+            continue
+        if not line.startswith(":"):
+            raise BaseException("bad Intel HEX record '%s'" % line)
+
+        record = bytes.fromhex(line[1:])
+        if sum(record) & 0xFF:
+            raise BaseException("bad Intel HEX checksum in '%s'" % line)
+        count, type = record[0], record[3]
+        address = (record[1] << 8) | record[2]
+        payload = record[4 : 4 + count]
+
+        if type == 0x00:
+            segments += [(base + address, payload)]
+        elif type == 0x01:
+            break
+        elif type == 0x02:
+            base = int.from_bytes(payload, "big") << 4
+        elif type == 0x04:
+            base = int.from_bytes(payload, "big") << 16
+    return segments
+
+
+def load_image(args):
+    """Returns the image to be flashed as a list of (address, bytes)."""
+    with open(args.filename, "rb") as file:
+        data = file.read()
+
+    if data.startswith(b"\x7fELF"):
+        return load_elf(data)
+    if data.startswith(b":"):
+        return load_ihex(data)
+    return [(args.address, data[: args.length])]
+
+
+def coalesce_pages(segments):
+    """Merges the segments into a dict of page address to page contents.
+    Bytes not covered by any segment are None."""
+    pages = {}
+    for address, data in segments:
+        for i, b in enumerate(data):
+            a = address + i
+            base = a & ~(FLASH_PAGE_SIZE - 1)
+            if base not in pages:
+                pages[base] = [None] * FLASH_PAGE_SIZE
+            pages[base][a - base] = b
+    return pages
+
+
+def fill_sector(pages, sector):
+    """Sectors are erased as a whole, so anything in one which the image
+    doesn't cover is read back first and written again afterwards."""
+    addresses = range(sector, sector + FLASH_SECTOR_SIZE, FLASH_PAGE_SIZE)
+    if all((a in pages) and (None not in pages[a]) for a in addresses):
+        return
+
+    old = read_flash_block(sector, FLASH_SECTOR_SIZE)
+    for a in addresses:
+        page = pages.get(a, [None] * FLASH_PAGE_SIZE)
+        pages[a] = [
+            old[a - sector + i] if b is None else b for i, b in enumerate(page)
+        ]
+
+
+def plan_flash_write(pages, args, log=print):
+    """Works out what needs doing to write the image to the connected chip:
+    returns the sectors to erase and the pages worth programming. The
+    calibration sector is left out unless asked for."""
+    outside = [a for a in pages if a + FLASH_PAGE_SIZE > profile["flash_size"]]
+    if outside:
+        raise BaseException(
+            "image has data at 0x%08x, beyond the end of the flash at 0x%08x"
+            % (min(outside), profile["flash_size"])
+        )
+
+    kept = skip_calibration_sector(list(pages), args, log)
+    pages = {a: pages[a] for a in kept}
+
+    sectors = sorted({a & ~(FLASH_SECTOR_SIZE - 1) for a in pages})
+    for sector in sectors:
+        fill_sector(pages, sector)
+    pages = {
+        a: bytes(page)
+        for a, page in sorted(pages.items())
+        if page != [0xFF] * FLASH_PAGE_SIZE
+    }
+    return sectors, pages
 
 
 def write_flash_main(args):
     connect()
-    with open(args.filename, "rb") as file:
-        file.seek(0, os.SEEK_END)
-        args.length = min(args.length, file.tell())
-        file.seek(0, os.SEEK_SET)
-        do_erase_flash(args)
+    sectors, pages = plan_flash_write(coalesce_pages(load_image(args)), args)
+
+    print("Erasing %d flash sectors:" % len(sectors))
+    for base in tqdm(iterable=sectors, unit_scale=FLASH_SECTOR_SIZE, unit="B"):
+        erase_flash_sector(base)
+
+    print("Writing %d flash pages from '%s':" % (len(pages), args.filename))
+    for base, page in tqdm(
+        iterable=pages.items(), unit_scale=FLASH_PAGE_SIZE, unit="B"
+    ):
+        write_flash_block(base, page)
+
+
+# These must match usb-descriptors.cpp.
+
+USBD_VID = 0x2E8A
+USBD_PID = 0x000A
+USBD_PRODUCT = "Telink debugger bridge"
+
+
+def discover_ports():
+    """Finds the control port of every bridge plugged in."""
+    from serial.tools import list_ports
+
+    bridges = {}
+    for p in sorted(list_ports.comports(), key=lambda p: p.device):
+        if (p.vid, p.pid) != (USBD_VID, USBD_PID):
+            continue
+        if p.product and (p.product != USBD_PRODUCT):
+            continue
+
+        # The control port is the bridge's first interface.
+        if p.location and not p.location.endswith(".0"):
+            continue
+        bridges.setdefault(p.serial_number or p.device, p.device)
+    return sorted(bridges.values())
+
+
+def multi_flash_worker(job):
+    """Runs in its own process, so the global serial port is ours alone."""
+    position, port, image, args = job
+
+    global serial_port, attach_mode
+    attach_mode = args.halt if args.attach else None
+    start = time.perf_counter()
+    try:
+        serial_port = open_serial_port(port)
+        connect()
+        sectors, pages = plan_flash_write(image, args, log=lambda s: None)
+
+        steps = len(sectors) + len(pages) * (1 if args.no_verify else 2)
+        with tqdm(total=steps, desc=port, position=position, unit="op") as bar:
+            bar.set_postfix_str("erase")
+            for base in sectors:
+                erase_flash_sector(base)
+                bar.update()
+
+            bar.set_postfix_str("write")
+            for base, page in pages.items():
+                write_flash_block(base, page)
+                bar.update()
+
+            if not args.no_verify:
+                bar.set_postfix_str("verify")
+                for base, page in pages.items():
+                    if read_flash_block(base, FLASH_PAGE_SIZE) != page:
+                        raise BaseException("verify failed at 0x%08x" % base)
+                    bar.update()
+            bar.set_postfix_str("done")
+
+        return (port, True, "ok", time.perf_counter() - start)
+    except KeyboardInterrupt:
+        raise
+    except BaseException as e:
+        return (port, False, str(e), time.perf_counter() - start)
+
+
+def multi_flash_main(args):
+    ports = args.ports.split(",") if args.ports else discover_ports()
+    if not ports:
+        raise BaseException("no debugger bridges found")
+
+    image = coalesce_pages(load_image(args))
+    print(
+        "Writing '%s' via %d debuggers: %s"
+        % (args.filename, len(ports), ", ".join(ports))
+    )
+
+    jobs = [(i, port, image, args) for i, port in enumerate(ports)]
+    with multiprocessing.Pool(
+        len(ports), initializer=tqdm.set_lock, initargs=(tqdm.get_lock(),)
+    ) as pool:
+        results = pool.map(multi_flash_worker, jobs)
+
+    print()
+    failures = 0
+    for port, ok, message, elapsed in results:
         print(
-            "Writing flash from 0x%08x-0x%08x from '%s':"
-            % (args.address, args.address + args.length, args.filename)
+            "%-20s %s %6.1fs %s"
+            % (port, "PASS" if ok else "FAIL", elapsed, message)
         )
-        for base in tqdm(
-            iterable=range(args.address, args.address + args.length, 256),
-            unit_scale=256,
-            unit="B",
-        ):
-            b = file.read(256)
-            write_flash_block(base, b)
+        if not ok:
+            failures += 1
+    print("%d passed, %d failed" % (len(results) - failures, failures))
+    if failures:
+        sys.exit(1)
+
+
+CAPTURE_PINS = ["sws", "rst", "dbg"]
+CAPTURE_SAMPLES_MAX = 128 * 1024  # the size of the bridge's buffer
+
+
+def write_vcd(file, edges, rate):
+    file.write("$timescale 1 ns $end\n")
+    file.write("$scope module telinkdebugger $end\n")
+    for i, name in enumerate(CAPTURE_PINS):
+        file.write("$var wire 1 %c %s $end\n" % (chr(33 + i), name))
+    file.write("$upscope $end\n")
+    file.write("$enddefinitions $end\n")
+
+    last = None
+    for sample, state in edges:
+        file.write("#%d\n" % (sample * 1000000000 // rate))
+        for i in range(len(CAPTURE_PINS)):
+            bit = (state >> i) & 1
+            if (last is None) or (bit != ((last >> i) & 1)):
+                file.write("%d%c\n" % (bit, chr(33 + i)))
+        last = state
+
+
+def write_edges(file, edges, rate):
+    file.write("time_ns,%s\n" % ",".join(CAPTURE_PINS))
+    for sample, state in edges:
+        file.write(
+            "%d,%s\n"
+            % (
+                sample * 1000000000 // rate,
+                ",".join(
+                    str((state >> i) & 1) for i in range(len(CAPTURE_PINS))
+                ),
+            )
+        )
+
+
+def capture_main(args):
+    connect()
+
+    serial_port.write(b"C%08x" % args.rate)
+    readhex()
+    if args.address is not None:
+        read_bytes_from_target(args.address, args.length)
+    else:
+        read_soc_id()
+    serial_port.write(b"c")
+    h = readhex()
+
+    edges = [
+        (int.from_bytes(h[i : i + 4], byteorder="big"), h[i + 4])
+        for i in range(0, len(h), 5)
+    ]
+    if not edges:
+        raise BaseException("nothing was captured")
+
+    samples = edges[-1][0] + 1
+    print("Captured %d samples with %d transitions" % (samples, len(edges)))
+    if samples >= CAPTURE_SAMPLES_MAX:
+        print(
+            "The capture buffer filled up (%.1fms at %dHz), so the end of the "
+            "transaction may be missing; try a lower --rate"
+            % (samples * 1000 / args.rate, args.rate),
+            file=sys.stderr,
+        )
+
+    with open(args.filename, "w") as file:
+        if args.filename.endswith(".vcd"):
+            write_vcd(file, edges, args.rate)
+        else:
+            write_edges(file, edges, args.rate)
+
+
+SEARCH_PATTERN_MAX = 32
+SEARCH_MATCHES_MAX = 256  # the bridge stops looking after this many
+
+
+def search_main(args):
+    connect()
+    pattern = bytes.fromhex(args.pattern)
+    mask = bytes.fromhex(args.mask) if args.mask else b"\xff" * len(pattern)
+    if not (1 <= len(pattern) <= SEARCH_PATTERN_MAX):
+        raise BaseException(
+            "pattern must be 1-%d bytes long" % SEARCH_PATTERN_MAX
+        )
+    if len(mask) != len(pattern):
+        raise BaseException("mask must be the same length as the pattern")
+
+    if args.area == "ram":
+        if args.address is None:
+            args.address = profile["ram_start"]
+        if args.length is None:
+            args.length = profile["ram_start"] + profile["ram_size"]
+            args.length -= args.address
+    else:
+        if args.address is None:
+            args.address = 0
+        if args.length is None:
+            args.length = profile["flash_size"] - args.address
+
+    print(
+        "Searching %s from 0x%08x-0x%08x:"
+        % (args.area, args.address, args.address + args.length)
+    )
+    serial_port.write(
+        b"f%c%08x%08x%02x%s%s"
+        % (
+            b"f" if args.area == "flash" else b"r",
+            args.address,
+            args.length,
+            len(pattern),
+            pattern.hex().encode("ascii"),
+            mask.hex().encode("ascii"),
+        )
+    )
+    h = readhex()
+    matches = [
+        int.from_bytes(h[i : i + 4], byteorder="big")
+        for i in range(0, len(h), 4)
+    ]
+    for m in matches:
+        print("0x%08x" % m)
+    if len(matches) == SEARCH_MATCHES_MAX:
+        print(
+            "Stopped after %d matches; search again from 0x%08x for the rest"
+            % (SEARCH_MATCHES_MAX, matches[-1] + 1),
+            file=sys.stderr,
+        )
+
+
+BENCH_RAM_CHUNKS = [16, 256, 1024]
+BENCH_FLASH_CHUNKS = [16, 256, 1024]
+BENCH_PROGRAM_CHUNKS = [16, 64, FLASH_PAGE_SIZE]
+BENCH_ERASE_CHUNKS = sorted(FLASH_ERASE_COMMANDS)
+
+
+def bench_ram_read(args, size, chunk):
+    for base in range(0, size, chunk):
+        read_bytes_from_target(profile["ram_start"] + base, chunk)
+
+
+def bench_ram_write(args, size, chunk):
+    data = bytes(chunk)
+    for base in range(0, size, chunk):
+        write_bytes_to_target(profile["ram_start"] + base, data)
+
+
+def bench_flash_read(args, size, chunk):
+    for base in range(0, size, chunk):
+        read_flash_block(args.flash_address + base, chunk)
+
+
+def bench_flash_erase(args, size, chunk):
+    for base in range(0, size, chunk):
+        erase_flash_sector(args.flash_address + base, chunk)
+
+
+def bench_flash_program(args, size, chunk):
+    # Each byte depends only on its address, so successive runs program the
+    # same values and don't need an erase in between.
+    for base in range(0, size, chunk):
+        data = bytes((base + i) & 0xFF for i in range(chunk))
+        write_flash_block(args.flash_address + base, data)
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def run_benchmark(name, func, args, chunk, size=None):
+    size = size or args.size
+
+    global latencies
+    latencies = []
+    start = time.perf_counter()
+    func(args, size, chunk)
+    elapsed = time.perf_counter() - start
+
+    l = sorted(latencies)
+    latencies = None
+    result = {
+        "test": name,
+        "chunk": chunk,
+        "bytes": size,
+        "seconds": elapsed,
+        "bytes_per_s": size / elapsed,
+        "round_trips": len(l),
+        "latency_p50_us": percentile(l, 50) * 1e6,
+        "latency_p90_us": percentile(l, 90) * 1e6,
+        "latency_p99_us": percentile(l, 99) * 1e6,
+        "latency_max_us": l[-1] * 1e6,
+    }
+    print(
+        "%-14s %5d bytes in %5d byte chunks: %10.0f B/s, %6d round trips, "
+        "p50 %7.0fus, p99 %7.0fus"
+        % (
+            name,
+            size,
+            chunk,
+            result["bytes_per_s"],
+            result["round_trips"],
+            result["latency_p50_us"],
+            result["latency_p99_us"],
+        )
+    )
+    return result
+
+
+def bench_main(args):
+    """Runs a fixed set of transfers and reports throughput and latency. This
+    is destructive: it scribbles over RAM, and erases and programs flash at
+    --flash-address. Block erases are only timed where --flash-address and
+    --erase-size are aligned to them."""
+    connect()
+    if args.size % FLASH_SECTOR_SIZE:
+        raise BaseException("size must be a multiple of the sector size")
+    if args.erase_size % FLASH_SECTOR_SIZE:
+        raise BaseException("erase size must be a multiple of the sector size")
+    end = args.flash_address + max(args.size, args.erase_size)
+    if args.flash_address <= calibration_sector() < end:
+        raise BaseException("refusing to benchmark over the calibration data")
+
+    results = []
+    for chunk in BENCH_RAM_CHUNKS:
+        results += [run_benchmark("ram_read", bench_ram_read, args, chunk)]
+    for chunk in BENCH_RAM_CHUNKS:
+        results += [run_benchmark("ram_write", bench_ram_write, args, chunk)]
+    for chunk in BENCH_ERASE_CHUNKS:
+        if (args.flash_address % chunk) or (args.erase_size % chunk):
+            continue
+        results += [
+            run_benchmark(
+                "flash_erase", bench_flash_erase, args, chunk, args.erase_size
+            )
+        ]
+
+    for base in range(0, args.size, FLASH_SECTOR_SIZE):
+        erase_flash_sector(args.flash_address + base)
+    for chunk in BENCH_PROGRAM_CHUNKS:
+        results += [
+            run_benchmark("flash_program", bench_flash_program, args, chunk)
+        ]
+    for chunk in BENCH_FLASH_CHUNKS:
+        results += [run_benchmark("flash_read", bench_flash_read, args, chunk)]
+
+    if args.output:
+        with open(args.output, "w", newline="") as file:
+            if args.output.endswith(".json"):
+                json.dump(results, file, indent=2)
+            else:
+                writer = csv.DictWriter(file, fieldnames=results[0].keys())
+                writer.writeheader()
+                writer.writerows(results)
+
+
+def uart_baud_main(args):
+    serial_port.write(b"b%08x" % args.baud)
+    readhex()
 
 
 def writeb_main(args):
-    print("Writing 0x%02x to 0x%04x" % (args.value, args.address))
+    print("Writing 0x%02x to 0x%08x" % (args.value, args.address))
     write_byte_to_target(args.address, args.value)
 
+
 def run_main(args):
     run()
 
 
+def open_serial_port(name):
+    return serial.Serial(
+        name,
+        115200,
+        serial.EIGHTBITS,
+        serial.PARITY_NONE,
+        serial.STOPBITS_ONE,
+    )
+
+
 def main():
     args_parser = argparse.ArgumentParser(description="Telink debugger client")
-    args_parser.add_argument("--serial-port", type=str, required=True)
+    port_group = args_parser.add_mutually_exclusive_group()
+    port_group.add_argument("--serial-port", type=str)
+    port_group.add_argument(
+        "--simulate",
+        action="store_true",
+        help="talk to an in-memory simulated bridge rather than a real one",
+    )
+    args_parser.add_argument(
+        "--attach",
+        action="store_true",
+        help="attach to the running target (or resume the previous "
+        "session) rather than resetting it",
+    )
+    args_parser.add_argument(
+        "--halt",
+        action="store_true",
+        help="with --attach, also halt the target",
+    )
     subparsers = args_parser.add_subparsers(dest="cmd", required=True)
 
     dump_ram_parser = subparsers.add_parser("dump_ram")
@@ -302,10 +889,10 @@ def main():
     read_ram_parser.set_defaults(func=read_ram_main)
     read_ram_parser.add_argument("filename", type=str)
     read_ram_parser.add_argument(
-        "address", nargs="?", default=0, type=lambda x: int(x, 0)
+        "address", nargs="?", default=None, type=lambda x: int(x, 0)
     )
     read_ram_parser.add_argument(
-        "length", nargs="?", default=0xC000, type=lambda x: int(x, 0)
+        "length", nargs="?", default=None, type=lambda x: int(x, 0)
     )
 
     flash_status_parser = subparsers.add_parser("flash_status")
@@ -321,9 +908,16 @@ def main():
         "length", nargs="?", default=0x7D000, type=lambda x: int(x, 0)
     )
 
-    write_flash_parser = subparsers.add_parser("write_flash")
+    write_flash_parser = subparsers.add_parser(
+        "write_flash",
+        description="Writes a raw binary, ELF or Intel HEX file to flash. "
+        "The address and length only apply to raw binaries.",
+    )
     write_flash_parser.set_defaults(func=write_flash_main)
     write_flash_parser.add_argument("filename", type=str)
+    write_flash_parser.add_argument(
+        "--overwrite-calibration", action="store_true"
+    )
     write_flash_parser.add_argument(
         "address", nargs="?", default=0, type=lambda x: int(x, 0)
     )
@@ -333,6 +927,9 @@ def main():
 
     erase_flash_parser = subparsers.add_parser("erase_flash")
     erase_flash_parser.set_defaults(func=erase_flash_main)
+    erase_flash_parser.add_argument(
+        "--overwrite-calibration", action="store_true"
+    )
     erase_flash_parser.add_argument(
         "address", nargs="?", default=0, type=lambda x: int(x, 0)
     )
@@ -340,9 +937,104 @@ def main():
         "length", nargs="?", default=0x7D000, type=lambda x: int(x, 0)
     )
 
+    capture_parser = subparsers.add_parser(
+        "capture",
+        description="Captures the SWS lines during a transaction. Files "
+        "ending in .vcd are written as VCD (which sigrok can import); "
+        "anything else gets a CSV edge list.",
+    )
+    capture_parser.set_defaults(func=capture_main)
+    capture_parser.add_argument("filename", type=str)
+    capture_parser.add_argument(
+        "--rate", default=25000000, type=lambda x: int(x, 0)
+    )
+    capture_parser.add_argument(
+        "--address",
+        default=None,
+        type=lambda x: int(x, 0),
+        help="read from here rather than reading the SoC ID",
+    )
+    capture_parser.add_argument(
+        "--length", default=1, type=lambda x: int(x, 0)
+    )
+
+    search_parser = subparsers.add_parser(
+        "search",
+        description="Searches RAM or flash on the debugger for a pattern of "
+        "hex bytes, returning only the addresses of matches. Bits which are "
+        "clear in the mask are ignored.",
+    )
+    search_parser.set_defaults(func=search_main)
+    search_parser.add_argument("area", choices=["ram", "flash"])
+    search_parser.add_argument("pattern", type=str)
+    search_parser.add_argument(
+        "address", nargs="?", default=None, type=lambda x: int(x, 0)
+    )
+    search_parser.add_argument(
+        "length", nargs="?", default=None, type=lambda x: int(x, 0)
+    )
+    search_parser.add_argument("--mask", type=str)
+
+    bench_parser = subparsers.add_parser(
+        "bench",
+        description=bench_main.__doc__,
+    )
+    bench_parser.set_defaults(func=bench_main)
+    bench_parser.add_argument(
+        "--size",
+        default=FLASH_SECTOR_SIZE,
+        type=lambda x: int(x, 0),
+        help="bytes transferred by each test",
+    )
+    bench_parser.add_argument(
+        "--flash-address", default=0x40000, type=lambda x: int(x, 0)
+    )
+    bench_parser.add_argument(
+        "--erase-size",
+        default=0x10000,
+        type=lambda x: int(x, 0),
+        help="bytes erased by each erase test",
+    )
+    bench_parser.add_argument(
+        "--output",
+        type=str,
+        help="write the results here, as JSON if it ends in .json or CSV "
+        "otherwise",
+    )
+
+    multi_flash_parser = subparsers.add_parser(
+        "multi_flash",
+        description="Writes and verifies the same image on several targets "
+        "at once, each via its own debugger. Ports are given with --ports, "
+        "or found by looking for bridges on USB. --serial-port is not used.",
+    )
+    multi_flash_parser.set_defaults(func=multi_flash_main)
+    multi_flash_parser.add_argument("filename", type=str)
+    multi_flash_parser.add_argument(
+        "address", nargs="?", default=0, type=lambda x: int(x, 0)
+    )
+    multi_flash_parser.add_argument(
+        "length", nargs="?", default=0x7D000, type=lambda x: int(x, 0)
+    )
+    multi_flash_parser.add_argument(
+        "--ports", type=str, help="comma-separated list of control ports"
+    )
+    multi_flash_parser.add_argument("--no-verify", action="store_true")
+    multi_flash_parser.add_argument(
+        "--overwrite-calibration", action="store_true"
+    )
+
     get_soc_id_parser = subparsers.add_parser("get_soc_id")
     get_soc_id_parser.set_defaults(func=get_soc_id_main)
 
+    uart_baud_parser = subparsers.add_parser(
+        "uart_baud",
+        description="Sets the baud rate of the bridge's UART, which is used "
+        "for capturing until a host opens the data port with its own.",
+    )
+    uart_baud_parser.set_defaults(func=uart_baud_main)
+    uart_baud_parser.add_argument("baud", type=lambda x: int(x, 0))
+
     run_parser = subparsers.add_parser("run")
     run_parser.set_defaults(func=run_main)
 
@@ -353,14 +1045,25 @@ def main():
 
     args = args_parser.parse_args()
 
+    global attach_mode
+    if args.attach:
+        attach_mode = args.halt
+
+    if args.simulate:
+        import simulator
+
+        sim = simulator.Simulator()
+        sim.start()
+        args.serial_port = sim.port
+
+    if args.func == multi_flash_main:
+        args.func(args)
+        return
+    if not args.serial_port:
+        args_parser.error("one of --serial-port or --simulate is required")
+
     global serial_port
-    serial_port = serial.Serial(
-        args.serial_port,
-        115200,
-        serial.EIGHTBITS,
-        serial.PARITY_NONE,
-        serial.STOPBITS_ONE,
-    )
+    serial_port = open_serial_port(args.serial_port)
 
     args.func(args)
 
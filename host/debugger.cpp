@@ -0,0 +1,446 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (c) 2024 David Given <dg@cowlark.com>
+ */
+
+#include <stdarg.h>
+#include <algorithm>
+#include <stdexcept>
+#include "debugger.h"
+#include "transport.h"
+
+#define FLASH_SECTOR_SIZE 4096
+#define FLASH_PAGE_SIZE 256
+#define TRANSFER_SIZE 1024
+
+static std::string format(const char* fmt, ...)
+{
+    char buffer[32];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, ap);
+    va_end(ap);
+    return buffer;
+}
+
+static int unhex(char c)
+{
+    if ((c >= '0') && (c <= '9'))
+        return c - '0';
+    if ((c >= 'a') && (c <= 'f'))
+        return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F'))
+        return c - 'A' + 10;
+    return -1;
+}
+
+static uint32_t get_quad(const Bytes& data, size_t offset)
+{
+    return (data.at(offset + 0) << 24) | (data.at(offset + 1) << 16) |
+           (data.at(offset + 2) << 8) | data.at(offset + 3);
+}
+
+Debugger::Debugger(Transport& port, unsigned max_in_flight):
+    _port(port),
+    _max_in_flight(max_in_flight)
+{
+}
+
+void Debugger::submit(const std::string& command, Callback callback)
+{
+    _pending.push_back(Request{callback});
+    _port.write(command);
+
+    while (_pending.size() > _max_in_flight)
+        pump();
+}
+
+void Debugger::sync()
+{
+    while (!_pending.empty())
+        pump();
+}
+
+void Debugger::pump()
+{
+    _port.flush();
+
+    char buffer[4096];
+    size_t count = _port.read(buffer, sizeof(buffer));
+    for (size_t i = 0; i < count; i++)
+    {
+        char c = buffer[i];
+        if (_in_comment)
+        {
+            if (c == '\n')
+                _in_comment = false;
+            continue;
+        }
+
+        switch (c)
+        {
+            case '#':
+                _in_comment = true;
+                break;
+
+            case '\n':
+            case '\r':
+            case ' ':
+                break;
+
+            case 'S':
+                complete(true);
+                break;
+
+            case 'E':
+            case '?':
+                complete(false);
+                break;
+
+            default:
+                if (unhex(c) == -1)
+                    throw std::runtime_error(
+                        format("bad response byte 0x%02x", (uint8_t)c));
+                _payload += c;
+        }
+    }
+}
+
+void Debugger::complete(bool success)
+{
+    if (_pending.empty())
+        throw std::runtime_error("unexpected response");
+    if (!success)
+    {
+        _pending.clear();
+        _payload.clear();
+        throw std::runtime_error("protocol error");
+    }
+
+    Request request = std::move(_pending.front());
+    _pending.pop_front();
+
+    if (_payload.size() & 1)
+        throw std::runtime_error("truncated response");
+    Bytes data;
+    data.reserve(_payload.size() / 2);
+    for (size_t i = 0; i < _payload.size(); i += 2)
+        data.push_back((unhex(_payload[i]) << 4) | unhex(_payload[i + 1]));
+    _payload.clear();
+
+    if (request.callback)
+        request.callback(data);
+}
+
+void Debugger::report(uint32_t done, uint32_t total)
+{
+    if (_progress)
+        _progress(done, total);
+}
+
+void Debugger::connect()
+{
+    submit("i");
+    read_profile();
+}
+
+void Debugger::attach(bool halt)
+{
+    submit(halt ? "a1" : "a0");
+    read_profile();
+}
+
+void Debugger::read_profile()
+{
+    submit("p",
+        [&](const Bytes& data)
+        {
+            _profile.socid = get_quad(data, 0);
+            _profile.ram_start = get_quad(data, 4);
+            _profile.ram_size = get_quad(data, 8);
+            _profile.flash_size = get_quad(data, 12);
+            _profile.calibration_address = get_quad(data, 16);
+            _profile.reg_spi_data = get_quad(data, 20);
+            _profile.reg_spi_ctrl = get_quad(data, 24);
+            _profile.reg_swire_id = get_quad(data, 28);
+        });
+    sync();
+}
+
+uint16_t Debugger::read_soc_id()
+{
+    uint16_t socid = 0;
+    submit("s",
+        [&](const Bytes& data)
+        {
+            socid = (data.at(0) << 8) | data.at(1);
+        });
+    sync();
+    return socid;
+}
+
+void Debugger::run()
+{
+    /* The bridge doesn't acknowledge this one. */
+
+    sync();
+    _port.write("g");
+    _port.flush();
+}
+
+void Debugger::read_bytes(uint32_t address, uint32_t length, Callback callback)
+{
+    submit(format("R%08x%08x", address, length), callback);
+}
+
+void Debugger::write_bytes(uint32_t address, const Bytes& data)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    std::string command = format("W%08x%08x", address, (uint32_t)data.size());
+    command.reserve(command.size() + data.size() * 2);
+    for (uint8_t b : data)
+    {
+        command += hex[b >> 4];
+        command += hex[b & 15];
+    }
+    submit(command);
+}
+
+void Debugger::write_byte(uint32_t address, uint8_t value)
+{
+    write_bytes(address, Bytes{value});
+}
+
+Bytes Debugger::read_ram(uint32_t address, uint32_t length)
+{
+    Bytes result;
+    result.reserve(length);
+
+    for (uint32_t done = 0; done < length; done += TRANSFER_SIZE)
+    {
+        uint32_t len = std::min<uint32_t>(TRANSFER_SIZE, length - done);
+        read_bytes(address + done,
+            len,
+            [&](const Bytes& data)
+            {
+                result.insert(result.end(), data.begin(), data.end());
+                report(result.size(), length);
+            });
+    }
+
+    sync();
+    return result;
+}
+
+void Debugger::write_ram(uint32_t address, const Bytes& data)
+{
+    for (uint32_t done = 0; done < data.size(); done += TRANSFER_SIZE)
+    {
+        uint32_t len = std::min<uint32_t>(TRANSFER_SIZE, data.size() - done);
+        write_bytes(address + done,
+            Bytes(data.begin() + done, data.begin() + done + len));
+    }
+
+    sync();
+}
+
+uint8_t Debugger::read_flash_status()
+{
+    uint8_t status;
+
+    write_byte(_profile.reg_spi_ctrl, 0x00); /* flash CS enable */
+    write_byte(_profile.reg_spi_data, 0x05); /* read status command */
+    write_byte(_profile.reg_spi_data, 0xff); /* dummy */
+    read_bytes(_profile.reg_spi_data,
+        1,
+        [&](const Bytes& data)
+        {
+            status = data.at(0);
+        });
+    write_byte(_profile.reg_spi_ctrl, 0x01); /* flash CS disable */
+
+    sync();
+    return status;
+}
+
+Bytes Debugger::read_flash(uint32_t address, uint32_t length)
+{
+    Bytes result;
+    result.reserve(length);
+
+    for (uint32_t done = 0; done < length; done += TRANSFER_SIZE)
+    {
+        uint32_t a = address + done;
+        uint32_t len = std::min<uint32_t>(TRANSFER_SIZE, length - done);
+
+        write_byte(_profile.reg_spi_ctrl, 0x00); /* flash CS enable */
+        write_byte(_profile.reg_spi_data, 0x03); /* read flash command */
+        write_byte(_profile.reg_spi_data, a >> 16);
+        write_byte(_profile.reg_spi_data, a >> 8);
+        write_byte(_profile.reg_spi_data, a);
+
+        write_byte(_profile.reg_swire_id, 0x80); /* SWS to FIFO mode */
+
+        for (uint32_t i = 0; i < len; i++)
+        {
+            write_byte(_profile.reg_spi_data, 0xff);
+            read_bytes(_profile.reg_spi_data,
+                1,
+                [&](const Bytes& data)
+                {
+                    result.push_back(data.at(0));
+                });
+        }
+
+        write_byte(_profile.reg_swire_id, 0x00); /* SWS to RAM mode */
+        write_byte(_profile.reg_spi_ctrl, 0x01); /* flash CS disable */
+
+        report(result.size(), length);
+    }
+
+    sync();
+    report(result.size(), length);
+    return result;
+}
+
+void Debugger::wait_for_flash_chip()
+{
+    for (;;)
+    {
+        uint8_t status = read_flash_status();
+        if (status & 0x20)
+            throw std::runtime_error("flash write failed");
+        if (!(status & 0x01))
+            break;
+    }
+}
+
+void Debugger::erase_flash_sector(uint32_t address)
+{
+    write_byte(_profile.reg_spi_ctrl, 0x00); /* flash CS enable */
+    write_byte(_profile.reg_spi_data, 0x06); /* write enable command */
+    write_byte(_profile.reg_spi_ctrl, 0x01); /* flash CS disable */
+
+    write_byte(_profile.reg_spi_ctrl, 0x00); /* flash CS enable */
+    write_byte(_profile.reg_spi_data, 0x20); /* erase sector command */
+    write_byte(_profile.reg_spi_data, address >> 16);
+    write_byte(_profile.reg_spi_data, address >> 8);
+    write_byte(_profile.reg_spi_data, address);
+    write_byte(_profile.reg_spi_ctrl, 0x01); /* flash CS disable */
+
+    wait_for_flash_chip();
+}
+
+void Debugger::erase_flash(uint32_t address, uint32_t length)
+{
+    if (!length)
+        return;
+
+    uint32_t start = address & ~(FLASH_SECTOR_SIZE - 1);
+    uint32_t end = (address + length + FLASH_SECTOR_SIZE - 1) &
+                   ~(FLASH_SECTOR_SIZE - 1);
+    for (uint32_t a = start; a < end; a += FLASH_SECTOR_SIZE)
+    {
+        erase_flash_sector(a);
+        report(a + FLASH_SECTOR_SIZE - start, end - start);
+    }
+}
+
+void Debugger::write_flash_page(
+    uint32_t address, const uint8_t* data, size_t len)
+{
+    write_byte(_profile.reg_spi_ctrl, 0x00); /* flash CS enable */
+    write_byte(_profile.reg_spi_data, 0x06); /* write enable command */
+    write_byte(_profile.reg_spi_ctrl, 0x01); /* flash CS disable */
+
+    write_byte(_profile.reg_spi_ctrl, 0x00); /* flash CS enable */
+    write_byte(_profile.reg_spi_data, 0x02); /* write flash command */
+    write_byte(_profile.reg_spi_data, address >> 16);
+    write_byte(_profile.reg_spi_data, address >> 8);
+    write_byte(_profile.reg_spi_data, address);
+
+    for (size_t i = 0; i < len; i++)
+        write_byte(_profile.reg_spi_data, data[i]);
+
+    write_byte(_profile.reg_spi_ctrl, 0x01); /* flash CS disable */
+
+    wait_for_flash_chip();
+}
+
+void Debugger::write_flash(uint32_t address, const Bytes& data)
+{
+    if (data.empty())
+        return;
+
+    /* Flash can only be erased a whole sector at a time, so anything else in
+     * the sectors being written is read back first and written again
+     * afterwards. */
+
+    uint32_t start = address & ~(FLASH_SECTOR_SIZE - 1);
+    uint32_t end = (address + data.size() + FLASH_SECTOR_SIZE - 1) &
+                   ~(FLASH_SECTOR_SIZE - 1);
+
+    Bytes image;
+    if (address > start)
+        image = read_flash(start, address - start);
+    image.insert(image.end(), data.begin(), data.end());
+    if ((start + image.size()) < end)
+    {
+        uint32_t a = start + image.size();
+        Bytes tail = read_flash(a, end - a);
+        image.insert(image.end(), tail.begin(), tail.end());
+    }
+
+    erase_flash(start, end - start);
+
+    /* Pages which are entirely 0xff are already as erased as they're going
+     * to get. */
+
+    for (uint32_t done = 0; done < image.size(); done += FLASH_PAGE_SIZE)
+    {
+        const uint8_t* page = &image[done];
+        if (std::any_of(page,
+                page + FLASH_PAGE_SIZE,
+                [](uint8_t b)
+                {
+                    return b != 0xff;
+                }))
+            write_flash_page(start + done, page, FLASH_PAGE_SIZE);
+        report(done + FLASH_PAGE_SIZE, image.size());
+    }
+}
+
+void hexdump(FILE* fp, const Bytes& bytes, uint32_t address)
+{
+    uint32_t end = address + bytes.size();
+    std::string ascii;
+
+    for (uint32_t a = address & ~15;; a++)
+    {
+        if ((a & 15) == 0)
+        {
+            fprintf(fp, "%08x : ", a);
+            ascii.clear();
+        }
+
+        if ((a >= address) && (a < end))
+        {
+            uint8_t b = bytes[a - address];
+            fprintf(fp, "%02x ", b);
+            ascii += ((b >= 32) && (b <= 126)) ? (char)b : '.';
+        }
+        else
+        {
+            fprintf(fp, "   ");
+            ascii += ' ';
+        }
+
+        if ((a & 15) == 15)
+        {
+            fprintf(fp, ": |%s|\n", ascii.c_str());
+            if (a >= end)
+                return;
+        }
+    }
+}
@@ -0,0 +1,117 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (c) 2024 David Given <dg@cowlark.com>
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+class Transport;
+
+typedef std::vector<uint8_t> Bytes;
+
+/* What the bridge tells us about the connected chip (the p command). */
+
+struct SocProfile
+{
+    uint16_t socid;
+    uint32_t ram_start;
+    uint32_t ram_size;
+    uint32_t flash_size;
+    uint32_t calibration_address;
+    uint32_t reg_spi_data;
+    uint32_t reg_spi_ctrl;
+    uint32_t reg_swire_id;
+};
+
+/* Talks to the bridge firmware. Commands are queued and sent without waiting
+ * for the previous response; up to max_in_flight may be outstanding at once,
+ * and responses are parsed in bulk as they arrive. Errors are reported by
+ * throwing std::runtime_error. */
+
+class Debugger
+{
+public:
+    typedef std::function<void(const Bytes& data)> Callback;
+    typedef std::function<void(uint32_t done, uint32_t total)> Progress;
+
+    Debugger(Transport& port, unsigned max_in_flight = 64);
+
+    /* Queues a raw command. The callback, if any, is called with the
+     * decoded hex payload once the response arrives. */
+    void submit(const std::string& command, Callback callback = nullptr);
+
+    /* Waits for every queued command to complete. */
+    void sync();
+
+    /* Resets the target and connects to it. */
+    void connect();
+
+    /* Connects to the target without resetting it, or picks up the
+     * bridge's existing session if there is one. */
+    void attach(bool halt);
+    void run();
+
+    /* Reads the SoC ID register on the chip itself, rather than trusting
+     * the profile. */
+    uint16_t read_soc_id();
+
+    const SocProfile& profile() const
+    {
+        return _profile;
+    }
+
+    /* Called periodically by the long-running operations below. */
+    void set_progress(Progress progress)
+    {
+        _progress = progress;
+    }
+
+    Bytes read_ram(uint32_t address, uint32_t length);
+    void write_ram(uint32_t address, const Bytes& data);
+
+    uint8_t read_flash_status();
+    Bytes read_flash(uint32_t address, uint32_t length);
+
+    /* Erases every sector the range touches. */
+    void erase_flash(uint32_t address, uint32_t length);
+
+    /* Anything else in the sectors touched is preserved. */
+    void write_flash(uint32_t address, const Bytes& data);
+
+private:
+    void read_bytes(uint32_t address, uint32_t length, Callback callback);
+    void write_bytes(uint32_t address, const Bytes& data);
+    void write_byte(uint32_t address, uint8_t value);
+
+    void wait_for_flash_chip();
+    void erase_flash_sector(uint32_t address);
+    void write_flash_page(uint32_t address, const uint8_t* data, size_t len);
+
+    void read_profile();
+    void pump();
+    void complete(bool success);
+    void report(uint32_t done, uint32_t total);
+
+private:
+    struct Request
+    {
+        Callback callback;
+    };
+
+    Transport& _port;
+    unsigned _max_in_flight;
+    std::deque<Request> _pending;
+    std::string _payload;
+    bool _in_comment = false;
+    SocProfile _profile = {};
+    Progress _progress;
+};
+
+extern void hexdump(FILE* fp, const Bytes& bytes, uint32_t address);
@@ -0,0 +1,348 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (c) 2024 David Given <dg@cowlark.com>
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "debugger.h"
+#include "serial.h"
+#if defined(HAVE_LIBUSB)
+#include "usb.h"
+#endif
+
+#define DEFAULT_FLASH_LENGTH 0x7d000
+#define FLASH_SECTOR_SIZE 4096
+
+typedef std::vector<std::string> Args;
+
+static bool attach = false;
+static bool halt = false;
+static bool overwrite_calibration = false;
+
+static void syntax()
+{
+    fprintf(stderr,
+        "Usage: telinkclient --serial-port=<port> <command> [<args>...]\n"
+#if defined(HAVE_LIBUSB)
+        "       telinkclient --usb[=<serial>] <command> [<args>...]\n"
+#endif
+        "Options:\n"
+        "  --attach      attach to the running target without resetting it\n"
+        "  --halt        with --attach, also halt the target\n"
+        "  --overwrite-calibration\n"
+        "                allow writing the factory calibration sector\n"
+        "Commands:\n"
+        "  dump_ram <address> [<length>]\n"
+        "  read_ram <filename> [<address>] [<length>]\n"
+        "  read_flash <filename> [<address>] [<length>]\n"
+        "  write_flash <filename> [<address>] [<length>]\n"
+        "  erase_flash [<address>] [<length>]\n"
+        "  flash_status\n"
+        "  get_soc_id\n"
+        "  run\n"
+        "  writeb <address> <value>\n");
+    exit(1);
+}
+
+static uint32_t get_number(const Args& args, size_t index, uint32_t def)
+{
+    if (index >= args.size())
+        return def;
+
+    char* end;
+    unsigned long value = strtoul(args[index].c_str(), &end, 0);
+    if (*end)
+        throw std::runtime_error("bad number '" + args[index] + "'");
+    return value;
+}
+
+static void connect(Debugger& debugger)
+{
+    if (attach)
+        debugger.attach(halt);
+    else
+        debugger.connect();
+}
+
+static void show_progress(uint32_t done, uint32_t total)
+{
+    fprintf(stderr, "\r%u/%u bytes", done, total);
+    if (done == total)
+        fputc('\n', stderr);
+}
+
+/* Calls func for the parts of the flash range which don't touch the factory
+ * calibration sector, unless overwriting it has been asked for. */
+
+static void avoiding_calibration(Debugger& debugger,
+    uint32_t address,
+    uint32_t length,
+    std::function<void(uint32_t address, uint32_t length)> func)
+{
+    uint32_t start = debugger.profile().calibration_address &
+                     ~(FLASH_SECTOR_SIZE - 1);
+    uint32_t end = start + FLASH_SECTOR_SIZE;
+    if (overwrite_calibration || (address >= end) ||
+        ((address + length) <= start))
+    {
+        func(address, length);
+        return;
+    }
+
+    fprintf(stderr,
+        "Skipping the factory calibration sector at 0x%08x (use "
+        "--overwrite-calibration to write it anyway)\n",
+        start);
+    if (address < start)
+        func(address, start - address);
+    if ((address + length) > end)
+        func(end, address + length - end);
+}
+
+static void dump_ram_main(Debugger& debugger, const Args& args)
+{
+    if (args.size() < 1)
+        syntax();
+    uint32_t address = get_number(args, 0, 0);
+    uint32_t length = get_number(args, 1, 0x100);
+
+    connect(debugger);
+    hexdump(stdout, debugger.read_ram(address, length), address);
+}
+
+static void read_ram_main(Debugger& debugger, const Args& args)
+{
+    if (args.size() < 1)
+        syntax();
+
+    connect(debugger);
+    uint32_t address = get_number(args, 1, debugger.profile().ram_start);
+    uint32_t length = get_number(args, 2, debugger.profile().ram_size);
+
+    fprintf(stderr,
+        "Reading RAM from 0x%08x-0x%08x into '%s':\n",
+        address,
+        address + length,
+        args[0].c_str());
+    Bytes data = debugger.read_ram(address, length);
+
+    std::ofstream f(args[0], std::ios::binary);
+    f.write((const char*)data.data(), data.size());
+    if (!f)
+        throw std::runtime_error("cannot write '" + args[0] + "'");
+}
+
+static void read_flash_main(Debugger& debugger, const Args& args)
+{
+    if (args.size() < 1)
+        syntax();
+    uint32_t address = get_number(args, 1, 0);
+    uint32_t length = get_number(args, 2, DEFAULT_FLASH_LENGTH);
+
+    connect(debugger);
+    fprintf(stderr,
+        "Reading flash from 0x%08x-0x%08x into '%s':\n",
+        address,
+        address + length,
+        args[0].c_str());
+    Bytes data = debugger.read_flash(address, length);
+
+    std::ofstream f(args[0], std::ios::binary);
+    f.write((const char*)data.data(), data.size());
+    if (!f)
+        throw std::runtime_error("cannot write '" + args[0] + "'");
+}
+
+static void write_flash_main(Debugger& debugger, const Args& args)
+{
+    if (args.size() < 1)
+        syntax();
+    uint32_t address = get_number(args, 1, 0);
+    uint32_t length = get_number(args, 2, DEFAULT_FLASH_LENGTH);
+
+    std::ifstream f(args[0], std::ios::binary);
+    if (!f)
+        throw std::runtime_error("cannot open '" + args[0] + "'");
+    Bytes data(std::istreambuf_iterator<char>(f), {});
+    if (data.size() > length)
+        data.resize(length);
+
+    connect(debugger);
+    if ((address + data.size()) > debugger.profile().flash_size)
+        throw std::runtime_error("image does not fit in flash");
+
+    fprintf(stderr,
+        "Writing flash from 0x%08x-0x%08x from '%s':\n",
+        address,
+        address + (uint32_t)data.size(),
+        args[0].c_str());
+    avoiding_calibration(debugger,
+        address,
+        data.size(),
+        [&](uint32_t a, uint32_t len)
+        {
+            auto begin = data.begin() + (a - address);
+            debugger.write_flash(a, Bytes(begin, begin + len));
+        });
+}
+
+static void erase_flash_main(Debugger& debugger, const Args& args)
+{
+    uint32_t address = get_number(args, 0, 0);
+    uint32_t length = get_number(args, 1, DEFAULT_FLASH_LENGTH);
+
+    connect(debugger);
+    fprintf(stderr,
+        "Erasing flash from 0x%08x-0x%08x:\n",
+        address,
+        address + length);
+    avoiding_calibration(debugger,
+        address,
+        length,
+        [&](uint32_t a, uint32_t len)
+        {
+            debugger.erase_flash(a, len);
+        });
+}
+
+static void flash_status_main(Debugger& debugger, const Args& args)
+{
+    connect(debugger);
+    printf("Flash status byte: 0x%02x\n", debugger.read_flash_status());
+}
+
+static void get_soc_id_main(Debugger& debugger, const Args& args)
+{
+    connect(debugger);
+    printf("SOC ID: 0x%04x\n", debugger.read_soc_id());
+}
+
+static void run_main(Debugger& debugger, const Args& args)
+{
+    debugger.run();
+}
+
+static void writeb_main(Debugger& debugger, const Args& args)
+{
+    if (args.size() != 2)
+        syntax();
+    uint32_t address = get_number(args, 0, 0);
+    uint8_t value = get_number(args, 1, 0);
+
+    printf("Writing 0x%02x to 0x%08x\n", value, address);
+    debugger.write_ram(address, Bytes{value});
+}
+
+static const struct
+{
+    const char* name;
+    void (*func)(Debugger& debugger, const Args& args);
+} commands[] = {
+    {"dump_ram",     dump_ram_main    },
+    {"read_ram",     read_ram_main    },
+    {"read_flash",   read_flash_main  },
+    {"write_flash",  write_flash_main },
+    {"erase_flash",  erase_flash_main },
+    {"flash_status", flash_status_main},
+    {"get_soc_id",   get_soc_id_main  },
+    {"run",          run_main         },
+    {"writeb",       writeb_main      },
+};
+
+int main(int argc, char* const* argv)
+{
+    static const struct option options[] = {
+        {"serial-port",           required_argument, nullptr, 's'},
+#if defined(HAVE_LIBUSB)
+        {"usb",                   optional_argument, nullptr, 'u'},
+#endif
+        {"attach",                no_argument,       nullptr, 'a'},
+        {"halt",                  no_argument,       nullptr, 'H'},
+        {"overwrite-calibration", no_argument,       nullptr, 'O'},
+        {"help",                  no_argument,       nullptr, 'h'},
+        {nullptr,                 0,                 nullptr, 0  }
+    };
+
+    std::string serial_port;
+    bool use_usb = false;
+    std::string usb_serial;
+    for (;;)
+    {
+        int c = getopt_long(argc, argv, "", options, nullptr);
+        if (c == -1)
+            break;
+
+        switch (c)
+        {
+            case 's':
+                serial_port = optarg;
+                break;
+
+            case 'a':
+                attach = true;
+                break;
+
+            case 'H':
+                halt = true;
+                break;
+
+            case 'O':
+                overwrite_calibration = true;
+                break;
+
+            case 'u':
+                use_usb = true;
+                if (optarg)
+                    usb_serial = optarg;
+                break;
+
+            default:
+                syntax();
+        }
+    }
+
+    if ((serial_port.empty() == !use_usb) || (optind >= argc))
+        syntax();
+
+    std::string cmd = argv[optind++];
+    Args args(argv + optind, argv + argc);
+
+    for (const auto& command : commands)
+    {
+        if (cmd != command.name)
+            continue;
+
+        try
+        {
+            std::unique_ptr<Transport> port;
+#if defined(HAVE_LIBUSB)
+            if (use_usb)
+                port.reset(new UsbPort(usb_serial));
+            else
+#endif
+                port.reset(new SerialPort(serial_port));
+
+            Debugger debugger(*port);
+            debugger.set_progress(show_progress);
+            command.func(debugger, args);
+            return 0;
+        }
+        catch (const std::exception& e)
+        {
+            fprintf(stderr, "Error: %s\n", e.what());
+            return 1;
+        }
+    }
+
+    syntax();
+}
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (c) 2024 David Given <dg@cowlark.com>
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+#include "serial.h"
+
+static std::runtime_error os_error(const std::string& what)
+{
+    return std::runtime_error(what + ": " + strerror(errno));
+}
+
+SerialPort::SerialPort(const std::string& path)
+{
+    /* Non-blocking, so that flush() can keep reading while it writes. */
+
+    _fd = open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (_fd == -1)
+        throw os_error("cannot open " + path);
+
+    struct termios t;
+    if (tcgetattr(_fd, &t) == -1)
+    {
+        close(_fd);
+        throw os_error("cannot configure " + path);
+    }
+
+    /* The baud rate is meaningless for a CDC port, but set it anyway in case
+     * this is a real UART. */
+
+    cfmakeraw(&t);
+    cfsetispeed(&t, B115200);
+    cfsetospeed(&t, B115200);
+    t.c_cflag |= CLOCAL | CREAD;
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+    tcsetattr(_fd, TCSANOW, &t);
+    tcflush(_fd, TCIOFLUSH);
+}
+
+SerialPort::~SerialPort()
+{
+    close(_fd);
+}
+
+void SerialPort::write(const std::string& data)
+{
+    _pending += data;
+}
+
+/* Waits until the port is readable or (if asked) writable, and reads
+ * whatever is available into the receive buffer. */
+
+bool SerialPort::wait(bool writing)
+{
+    struct pollfd pfd = {};
+    pfd.fd = _fd;
+    pfd.events = POLLIN | (writing ? POLLOUT : 0);
+    if (poll(&pfd, 1, -1) == -1)
+    {
+        if (errno == EINTR)
+            return false;
+        throw os_error("poll error");
+    }
+
+    if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+    {
+        char buffer[4096];
+        ssize_t count = ::read(_fd, buffer, sizeof(buffer));
+        if (count == 0)
+            throw std::runtime_error("serial port closed");
+        if (count > 0)
+            _received.insert(_received.end(), buffer, buffer + count);
+        else if ((errno != EINTR) && (errno != EAGAIN))
+            throw os_error("read error");
+    }
+
+    return pfd.revents & POLLOUT;
+}
+
+void SerialPort::flush()
+{
+    /* Responses are read as we go, so the bridge never stalls with its
+     * output buffers full while we're still sending it commands. */
+
+    size_t done = 0;
+    while (done < _pending.size())
+    {
+        if (!wait(true))
+            continue;
+
+        ssize_t count = ::write(_fd, &_pending[done], _pending.size() - done);
+        if (count == -1)
+        {
+            if ((errno == EINTR) || (errno == EAGAIN))
+                continue;
+            throw os_error("write error");
+        }
+        done += count;
+    }
+
+    _pending.clear();
+}
+
+size_t SerialPort::read(char* buffer, size_t length)
+{
+    while (_received.empty())
+        wait(false);
+
+    size_t count = std::min(length, _received.size());
+    std::copy(_received.begin(), _received.begin() + count, buffer);
+    _received.erase(_received.begin(), _received.begin() + count);
+    return count;
+}
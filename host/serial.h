@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (c) 2024 David Given <dg@cowlark.com>
+ */
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include "transport.h"
+
+/* A raw termios serial port, such as the bridge's CDC control port. */
+
+class SerialPort : public Transport
+{
+public:
+    SerialPort(const std::string& path);
+    ~SerialPort();
+
+    SerialPort(const SerialPort&) = delete;
+    SerialPort& operator=(const SerialPort&) = delete;
+
+    void write(const std::string& data) override;
+    void flush() override;
+    size_t read(char* buffer, size_t length) override;
+
+private:
+    bool wait(bool writing);
+
+private:
+    int _fd;
+    std::string _pending;
+    std::deque<char> _received;
+};
@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (c) 2024 David Given <dg@cowlark.com>
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+/* Something which carries the control protocol to the bridge. Writes are
+ * buffered until flush() is called, so that a batch of commands goes out in
+ * as few system calls as possible. */
+
+class Transport
+{
+public:
+    virtual ~Transport() {}
+
+    virtual void write(const std::string& data) = 0;
+    virtual void flush() = 0;
+
+    /* Blocks until at least one byte is available, then returns as many as
+     * will fit. */
+    virtual size_t read(char* buffer, size_t length) = 0;
+};
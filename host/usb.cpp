@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (c) 2024 David Given <dg@cowlark.com>
+ */
+
+#include <libusb.h>
+#include <algorithm>
+#include <stdexcept>
+#include "usb.h"
+
+/* These must match usb-descriptors.cpp. */
+
+#define USBD_VID 0x2E8A
+#define USBD_PID 0x000A
+#define USBD_ITF_VENDOR 4
+#define USBD_VENDOR_EP_OUT 0x05
+#define USBD_VENDOR_EP_IN 0x85
+
+#define NUM_TRANSFERS 4
+#define TRANSFER_SIZE 4096
+#define TIMEOUT_MS 5000
+
+static std::runtime_error usb_error(const std::string& what, int e)
+{
+    return std::runtime_error(what + ": " + libusb_strerror((libusb_error)e));
+}
+
+static bool serial_matches(libusb_device* device,
+    libusb_device_handle* handle,
+    const std::string& serial)
+{
+    if (serial.empty())
+        return true;
+
+    libusb_device_descriptor desc;
+    if (libusb_get_device_descriptor(device, &desc) != 0)
+        return false;
+
+    unsigned char buffer[64];
+    int len = libusb_get_string_descriptor_ascii(
+        handle, desc.iSerialNumber, buffer, sizeof(buffer));
+    return (len > 0) && (serial == std::string((char*)buffer, len));
+}
+
+UsbPort::UsbPort(const std::string& serial)
+{
+    int e = libusb_init(&_context);
+    if (e != 0)
+        throw usb_error("cannot initialise libusb", e);
+
+    libusb_device** devices;
+    ssize_t count = libusb_get_device_list(_context, &devices);
+    for (ssize_t i = 0; (i < count) && !_handle; i++)
+    {
+        libusb_device_descriptor desc;
+        if (libusb_get_device_descriptor(devices[i], &desc) != 0)
+            continue;
+        if ((desc.idVendor != USBD_VID) || (desc.idProduct != USBD_PID))
+            continue;
+
+        libusb_device_handle* handle;
+        if (libusb_open(devices[i], &handle) != 0)
+            continue;
+        if (serial_matches(devices[i], handle, serial))
+            _handle = handle;
+        else
+            libusb_close(handle);
+    }
+    if (count >= 0)
+        libusb_free_device_list(devices, 1);
+
+    if (!_handle)
+    {
+        libusb_exit(_context);
+        throw std::runtime_error("no debugger bridge found on USB");
+    }
+
+    e = libusb_claim_interface(_handle, USBD_ITF_VENDOR);
+    if (e != 0)
+    {
+        libusb_close(_handle);
+        libusb_exit(_context);
+        throw usb_error("cannot claim debugger interface", e);
+    }
+
+    for (int i = 0; i < NUM_TRANSFERS; i++)
+    {
+        libusb_transfer* transfer = libusb_alloc_transfer(0);
+        libusb_fill_bulk_transfer(transfer,
+            _handle,
+            USBD_VENDOR_EP_IN,
+            new unsigned char[TRANSFER_SIZE],
+            TRANSFER_SIZE,
+            transfer_cb,
+            this,
+            0);
+        _transfers.push_back(transfer);
+
+        e = libusb_submit_transfer(transfer);
+        if (e != 0)
+            throw usb_error("cannot submit transfer", e);
+        _in_flight++;
+    }
+}
+
+UsbPort::~UsbPort()
+{
+    for (libusb_transfer* transfer : _transfers)
+        libusb_cancel_transfer(transfer);
+    while (_in_flight)
+    {
+        if (libusb_handle_events(_context) != 0)
+            break;
+    }
+
+    for (libusb_transfer* transfer : _transfers)
+    {
+        delete[] transfer->buffer;
+        libusb_free_transfer(transfer);
+    }
+
+    libusb_release_interface(_handle, USBD_ITF_VENDOR);
+    libusb_close(_handle);
+    libusb_exit(_context);
+}
+
+void UsbPort::transfer_cb(libusb_transfer* transfer)
+{
+    UsbPort* self = (UsbPort*)transfer->user_data;
+
+    switch (transfer->status)
+    {
+        case LIBUSB_TRANSFER_COMPLETED:
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            self->_received.insert(self->_received.end(),
+                transfer->buffer,
+                transfer->buffer + transfer->actual_length);
+            if (libusb_submit_transfer(transfer) == 0)
+                return;
+            self->_error = LIBUSB_ERROR_IO;
+            break;
+
+        case LIBUSB_TRANSFER_CANCELLED:
+            break;
+
+        default:
+            self->_error = LIBUSB_ERROR_IO;
+            break;
+    }
+
+    self->_in_flight--;
+}
+
+void UsbPort::handle_events()
+{
+    int e = libusb_handle_events(_context);
+    if (e == 0)
+        e = _error;
+    if (e != 0)
+        throw usb_error("USB error", e);
+}
+
+void UsbPort::write(const std::string& data)
+{
+    _pending += data;
+}
+
+void UsbPort::flush()
+{
+    /* libusb splits this into packets. The IN transfers keep being serviced
+     * while this blocks, so the device can't stall with its reply buffer
+     * full. */
+
+    size_t done = 0;
+    while (done < _pending.size())
+    {
+        int transferred;
+        int e = libusb_bulk_transfer(_handle,
+            USBD_VENDOR_EP_OUT,
+            (unsigned char*)&_pending[done],
+            _pending.size() - done,
+            &transferred,
+            TIMEOUT_MS);
+        if (e != 0)
+            throw usb_error("write error", e);
+        done += transferred;
+    }
+
+    _pending.clear();
+}
+
+size_t UsbPort::read(char* buffer, size_t length)
+{
+    while (_received.empty())
+        handle_events();
+
+    size_t count = std::min(length, _received.size());
+    std::copy(_received.begin(), _received.begin() + count, buffer);
+    _received.erase(_received.begin(), _received.begin() + count);
+    return count;
+}
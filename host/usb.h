@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (c) 2024 David Given <dg@cowlark.com>
+ */
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+#include "transport.h"
+
+struct libusb_context;
+struct libusb_device_handle;
+struct libusb_transfer;
+
+/* Talks to the bridge's vendor-class bulk interface via libusb, bypassing the
+ * tty layer entirely. Several IN transfers are kept queued at all times so
+ * the device never has to wait for us to ask for more. */
+
+class UsbPort : public Transport
+{
+public:
+    /* If serial is empty, the first bridge found is used. */
+    UsbPort(const std::string& serial);
+    ~UsbPort();
+
+    UsbPort(const UsbPort&) = delete;
+    UsbPort& operator=(const UsbPort&) = delete;
+
+    void write(const std::string& data) override;
+    void flush() override;
+    size_t read(char* buffer, size_t length) override;
+
+private:
+    static void transfer_cb(libusb_transfer* transfer);
+    void handle_events();
+
+private:
+    libusb_context* _context = nullptr;
+    libusb_device_handle* _handle = nullptr;
+    std::vector<libusb_transfer*> _transfers;
+    int _in_flight = 0;
+    int _error = 0;
+    std::string _pending;
+    std::deque<char> _received;
+};
@@ -0,0 +1,222 @@
+#!/usr/bin/python3
+"""A stand-in for the debugger bridge, for testing and benchmarking the host
+tools without any hardware. It implements the control protocol on a
+pseudo-terminal, talking to an in-memory TLSR8232 with a SPI flash chip
+attached.
+
+Run it standalone and it prints the name of the pty to connect to:
+
+    $ ./simulator.py &
+    /dev/pts/5
+    $ ./client.py --serial-port=/dev/pts/5 get_soc_id
+"""
+
+import os
+import pty
+import threading
+import tty
+
+SOCID = 0x5316
+RAM_START = 0x8000
+RAM_SIZE = 0x4000
+FLASH_SIZE = 0x80000
+CALIBRATION_ADDRESS = 0x77000
+
+REG_SOC_ID = 0x7E
+REG_SPI_DATA = 0x0C
+REG_SPI_CTRL = 0x0D
+REG_SWIRE_ID = 0xB3
+
+# Sector, 32kB block and 64kB block erase.
+ERASE_SIZES = {0x20: 0x1000, 0x52: 0x8000, 0xD8: 0x10000}
+
+SEARCH_MATCHES_MAX = 256
+
+
+class Flash:
+    """A SPI NOR flash chip, driven a byte at a time through the flash
+    controller's data register."""
+
+    def __init__(self):
+        self.data = bytearray(b"\xff" * FLASH_SIZE)
+        self.command = []
+        self.output = 0xFF
+        self.write_enabled = False
+
+    def select(self):
+        self.command = []
+
+    def deselect(self):
+        if self.command and (self.command[0] in [0x02, 0x20, 0x52, 0xD8]):
+            self.write_enabled = False
+        self.command = []
+
+    def address(self):
+        c = self.command
+        return ((c[1] << 16) | (c[2] << 8) | c[3]) % FLASH_SIZE
+
+    def transfer(self, byte):
+        c = self.command
+        c += [byte]
+        op = c[0]
+
+        if op == 0x06:  # write enable
+            self.write_enabled = True
+        elif op == 0x05:  # read status
+            self.output = 0x02 if self.write_enabled else 0x00
+        elif (op == 0x03) and (len(c) > 4):  # read
+            address = (self.address() + len(c) - 5) % FLASH_SIZE
+            self.output = self.data[address]
+        elif (op == 0x02) and (len(c) > 4) and self.write_enabled:  # program
+            page = self.address() & ~0xFF
+            offset = (self.address() + len(c) - 5) & 0xFF
+            self.data[page + offset] &= byte
+        elif (op in ERASE_SIZES) and (len(c) == 4) and self.write_enabled:
+            size = ERASE_SIZES[op]
+            block = self.address() & ~(size - 1)
+            self.data[block : block + size] = b"\xff" * size
+
+
+class Target:
+    """The registers and RAM of the chip, as seen over SWS."""
+
+    def __init__(self):
+        self.memory = bytearray(0x10000)
+        self.memory[REG_SOC_ID] = SOCID & 0xFF
+        self.memory[REG_SOC_ID + 1] = SOCID >> 8
+        self.flash = Flash()
+
+    def read(self, address):
+        address &= 0xFFFF
+        if address == REG_SPI_DATA:
+            return self.flash.output
+        return self.memory[address]
+
+    def write(self, address, byte):
+        address &= 0xFFFF
+        if address == REG_SPI_DATA:
+            self.flash.transfer(byte)
+        elif address == REG_SPI_CTRL:
+            if byte & 1:
+                self.flash.deselect()
+            else:
+                self.flash.select()
+        self.memory[address] = byte
+
+
+class Simulator:
+    def __init__(self):
+        self.target = Target()
+        self.fd, slave = pty.openpty()
+        tty.setraw(self.fd)
+        tty.setraw(slave)
+        self.slave = slave  # kept open so clients can come and go
+        self.port = os.ttyname(slave)
+        self.buffer = b""
+
+    def start(self):
+        """Serves the protocol in a background thread."""
+        thread = threading.Thread(target=self.serve, daemon=True)
+        thread.start()
+
+    def read(self, count):
+        while len(self.buffer) < count:
+            self.buffer += os.read(self.fd, 65536)
+        data, self.buffer = self.buffer[:count], self.buffer[count:]
+        return data
+
+    def readhex(self, digits):
+        return int(self.read(digits), 16)
+
+    def write(self, data):
+        os.write(self.fd, data)
+
+    def serve(self):
+        while True:
+            c = self.read(1)
+            if c == b"i":
+                self.write(b"# init\n# found TLSR8232\nS\n")
+            elif c == b"p":
+                self.write(
+                    b"# TLSR8232\n%08x%08x%08x%08x%08x%08x%08x%08x\nS\n"
+                    % (
+                        SOCID,
+                        RAM_START,
+                        RAM_SIZE,
+                        FLASH_SIZE,
+                        CALIBRATION_ADDRESS,
+                        REG_SPI_DATA,
+                        REG_SPI_CTRL,
+                        REG_SWIRE_ID,
+                    )
+                )
+            elif c == b"a":
+                self.read(1)
+                self.write(b"# attach\n# found TLSR8232\nS\n")
+            elif c == b"s":
+                socid = self.target.read(REG_SOC_ID)
+                socid |= self.target.read(REG_SOC_ID + 1) << 8
+                self.write(b"%04x\nS\n" % socid)
+            elif c == b"r":
+                self.read(1)
+                self.write(b"S\n")
+            elif c == b"g":
+                pass
+            elif c == b"b":
+                self.readhex(8)
+                self.write(b"S\n")
+            elif c == b"R":
+                address = self.readhex(8)
+                count = self.readhex(8)
+                if count:
+                    data = bytes(
+                        self.target.read(address + i) for i in range(count)
+                    )
+                    self.write(data.hex().encode("ascii") + b"\n")
+                self.write(b"S\n")
+            elif c == b"W":
+                address = self.readhex(8)
+                count = self.readhex(8)
+                data = bytes.fromhex(str(self.read(count * 2), "ascii"))
+                for i, b in enumerate(data):
+                    self.target.write(address + i, b)
+                self.write(b"S\n")
+            elif c == b"f":
+                flash = self.read(1) == b"f"
+                address = self.readhex(8)
+                count = self.readhex(8)
+                length = self.readhex(2)
+                pattern = bytes.fromhex(str(self.read(length * 2), "ascii"))
+                mask = bytes.fromhex(str(self.read(length * 2), "ascii"))
+                if flash:
+                    data = self.target.flash.data[address : address + count]
+                else:
+                    data = bytes(
+                        self.target.read(address + i) for i in range(count)
+                    )
+                matches = 0
+                for i in range(len(data) - length + 1):
+                    if all(
+                        ((data[i + j] ^ pattern[j]) & mask[j]) == 0
+                        for j in range(length)
+                    ):
+                        self.write(b"%08x\n" % (address + i))
+                        matches += 1
+                        if matches == SEARCH_MATCHES_MAX:
+                            self.write(b"# too many matches\n")
+                            break
+                self.write(b"S\n")
+            elif c in [b"\n", b"\r", b" "]:
+                pass
+            else:
+                self.write(b"?\n# unknown command\n")
+
+
+def main():
+    simulator = Simulator()
+    print(simulator.port, flush=True)
+    simulator.serve()
+
+
+if __name__ == "__main__":
+    main()
@@ -4,6 +4,10 @@
 
 extern void usb_bridge_init(void);
 extern void stdio_queue_init(void);
+extern void uart_set_baud_rate(uint32_t baud);
 
 extern queue_t rd_queue;
 extern queue_t wr_queue;
+
+extern volatile bool uart_capture_enabled;
+extern volatile bool command_idle;
@@ -7,6 +7,12 @@
 #include "globals.h"
 #include "pico/stdio/driver.h"
 
+/* Set by the command loop while it waits for the next command, and cleared
+ * here as soon as it takes a byte, so core1 knows when it's safe to hand the
+ * command stream to another port. */
+
+volatile bool command_idle;
+
 static void stdio_queue_out_chars(const char* buf, int length)
 {
     for (int i = 0; i < length; i++)
@@ -17,7 +23,10 @@ static int stdio_queue_in_chars(char* buf, int length)
 {
     int i = 0;
     while (i < length && !queue_is_empty(&rd_queue))
+    {
+        command_idle = false;
         queue_remove_blocking(&rd_queue, &buf[i++]);
+    }
     return i ? i : PICO_ERROR_NO_DATA;
 }
 
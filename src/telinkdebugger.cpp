@@ -10,6 +10,8 @@
 #include "hardware/pio.h"
 #include "hardware/clocks.h"
 #include "hardware/divider.h"
+#include "hardware/dma.h"
+#include "hardware/vreg.h"
 
 #include "sws.pio.h"
 #include "globals.h"
@@ -21,15 +23,50 @@
 
 #define SM_RX 0
 #define SM_TX 1
+#define SM_CAPTURE 2
+
+/* Each word holds eight four-bit samples, starting at SWS_PIN. */
+
+#define CAPTURE_BUFFER_WORDS (64 * 1024 / 4)
+#define CAPTURE_SAMPLES_PER_WORD 8
 
 #define BUFFER_SIZE_BITS 4096
 
-#define REG_ADDR8(n) (n)
-#define REG_ADDR16(n) (n)
-#define REG_ADDR32(n) (n)
+#if !defined(SYS_CLOCK_KHZ)
+#define SYS_CLOCK_KHZ 125000
+#endif
+#if SYS_CLOCK_KHZ > 250000
+#error "SYS_CLOCK_KHZ must be 250000 or less"
+#endif
+#define STOCK_SYS_CLOCK_KHZ 125000
+
+#if !defined(RESET_AT_BOOT)
+#define RESET_AT_BOOT 1
+#endif
+
+/* How long the target takes to come out of reset. */
+
+#define TARGET_BOOT_MS 20
+
+/* The low pulse which starts a read, and the pause after one. (These were
+ * originally 256 cycles at the stock clock.) */
+
+#define SWS_RX_DELAY_NS 2048
+
+#define SWS_PROBE_CLOCK_HZ 10.0e6
+
+#define SEARCH_PATTERN_MAX 32
+#define SEARCH_MATCHES_MAX 256
+
+#define REG_ADDR8(n) (current_profile->reg_base + (n))
+#define REG_ADDR16(n) (current_profile->reg_base + (n))
+#define REG_ADDR32(n) (current_profile->reg_base + (n))
 
 #define reg_soc_id REG_ADDR16(0x7e)
 
+#define reg_spi_data REG_ADDR8(0x0c)
+#define reg_spi_ctrl REG_ADDR8(0x0d)
+
 #define reg_swire_data REG_ADDR8(0xb0)
 #define reg_swire_ctrl1 REG_ADDR8(0xb1)
 #define reg_swire_clk_div REG_ADDR8(0xb2)
@@ -40,16 +77,85 @@
 
 #define reg_debug_runstate REG_ADDR8(0x602)
 
+struct soc_profile_t
+{
+    uint16_t socid;
+    const char* name;
+    int address_bytes;   /* width of addresses on the SWS bus */
+    uint32_t reg_base;   /* where the register file appears */
+    uint32_t ram_start;
+    uint32_t ram_size;
+    uint32_t flash_size; /* if the flash chip doesn't say */
+    uint32_t calibration_address; /* factory radio calibration sector */
+    double sws_clock_hz;  /* our transmit clock once connected */
+    uint8_t swire_clk_div; /* target's SWS divider; 0 leaves it alone */
+};
+
+/* The first entry is also used before we know what we're talking to. The SWS
+ * settings are the fastest known to work reliably on each part. */
+
+static const soc_profile_t soc_profiles[] = {
+    {.socid = 0x5316,
+     .name = "TLSR8232",
+     .address_bytes = 2,
+     .reg_base = 0x000000,
+     .ram_start = 0x8000,
+     .ram_size = 0x4000,
+     .flash_size = 0x80000,
+     .calibration_address = 0x77000,
+     .sws_clock_hz = 10.0e6,
+     .swire_clk_div = 0},
+    {.socid = 0x5562,
+     .name = "TLSR825x",
+     .address_bytes = 3,
+     .reg_base = 0x800000,
+     .ram_start = 0x840000,
+     .ram_size = 0x8000, /* the 8253 and 8258 have more */
+     .flash_size = 0x80000,
+     .calibration_address = 0x77000,
+     .sws_clock_hz = 16.0e6,
+     .swire_clk_div = 4},
+};
+
+#define NUM_SOC_PROFILES (sizeof(soc_profiles) / sizeof(*soc_profiles))
+
+/* Where the calibration sector lives depends on the size of the flash, which
+ * varies between parts with the same SoC ID. */
+
+struct flash_layout_t
+{
+    uint32_t flash_size;
+    uint32_t calibration_address;
+};
+
+static const flash_layout_t flash_layouts[] = {
+    {.flash_size = 0x80000,  .calibration_address = 0x77000 },
+    {.flash_size = 0x100000, .calibration_address = 0xfe000 },
+    {.flash_size = 0x200000, .calibration_address = 0x1fe000},
+};
+
+#define NUM_FLASH_LAYOUTS (sizeof(flash_layouts) / sizeof(*flash_layouts))
+
+static const soc_profile_t* current_profile = &soc_profiles[0];
+static flash_layout_t current_flash;
+
 static uint32_t input_buffer[BUFFER_SIZE_BITS / 8];
 static uint32_t output_buffer[BUFFER_SIZE_BITS / 8];
 
 static int input_buffer_bit_ptr;
 static int output_buffer_bit_ptr;
 
+static uint32_t capture_buffer[CAPTURE_BUFFER_WORDS];
+static int capture_dma_channel;
+static bool is_capturing;
+
 static int sws_tx_program_offset;
 static int sws_rx_program_offset;
+static int sws_capture_program_offset;
 
 static bool is_connected;
+static uint32_t search_table[256];
+static const char* clock_warning;
 
 static void write_nine_bit_byte(uint16_t byte)
 {
@@ -79,6 +185,13 @@ static void write_data_word(uint16_t word)
     write_data_byte(word & 0xff);
 }
 
+static void write_data_address(uint32_t address)
+{
+    if (current_profile->address_bytes > 2)
+        write_data_byte(address >> 16);
+    write_data_word(address);
+}
+
 static uint8_t read_byte()
 {
     pio_gpio_init(pio1, SWS_PIN);
@@ -89,10 +202,10 @@ static uint8_t read_byte()
     return pio_sm_get_blocking(pio1, SM_RX);
 }
 
-static uint8_t read_first_debug_byte(uint16_t address)
+static uint8_t read_first_debug_byte(uint32_t address)
 {
     write_cmd_byte(0x5a);
-    write_data_word(address);
+    write_data_address(address);
     write_data_byte(0x80);
 
     return read_byte();
@@ -108,14 +221,14 @@ static void finish_reading_debug_bytes()
     write_cmd_byte(0xff);
 }
 
-static uint8_t read_single_debug_byte(uint16_t address)
+static uint8_t read_single_debug_byte(uint32_t address)
 {
     uint8_t value = read_first_debug_byte(address);
     finish_reading_debug_bytes();
     return value;
 }
 
-static uint16_t read_single_debug_word(uint16_t address)
+static uint16_t read_single_debug_word(uint32_t address)
 {
     uint8_t v1 = read_first_debug_byte(address);
     uint8_t v2 = read_next_debug_byte();
@@ -123,10 +236,10 @@ static uint16_t read_single_debug_word(uint16_t address)
     return v1 | (v2 << 8);
 }
 
-static void write_first_debug_byte(uint16_t address, uint8_t value)
+static void write_first_debug_byte(uint32_t address, uint8_t value)
 {
     write_cmd_byte(0x5a);
-    write_data_word(address);
+    write_data_address(address);
     write_data_byte(0x00);
     write_data_byte(value);
 }
@@ -141,20 +254,20 @@ static void finish_writing_debug_bytes()
     write_cmd_byte(0xff);
 }
 
-static void write_single_debug_byte(uint16_t address, uint8_t value)
+static void write_single_debug_byte(uint32_t address, uint8_t value)
 {
     write_first_debug_byte(address, value);
     finish_writing_debug_bytes();
 }
 
-static void write_single_debug_word(uint16_t address, uint16_t value)
+static void write_single_debug_word(uint32_t address, uint16_t value)
 {
     write_first_debug_byte(address, value);
     write_next_debug_byte(value >> 8);
     finish_writing_debug_bytes();
 }
 
-static void write_single_debug_quad(uint16_t address, uint32_t value)
+static void write_single_debug_quad(uint32_t address, uint32_t value)
 {
     write_first_debug_byte(address, value);
     write_next_debug_byte(value >> 8);
@@ -163,6 +276,22 @@ static void write_single_debug_quad(uint16_t address, uint32_t value)
     finish_writing_debug_bytes();
 }
 
+static void flash_select(bool selected)
+{
+    write_single_debug_byte(reg_spi_ctrl, selected ? 0x00 : 0x01);
+}
+
+static void flash_send(uint8_t byte)
+{
+    write_single_debug_byte(reg_spi_data, byte);
+}
+
+static uint8_t flash_receive()
+{
+    flash_send(0xff);
+    return read_single_debug_byte(reg_spi_data);
+}
+
 static void halt_target()
 {
     write_single_debug_byte(reg_debug_runstate, 0x05);
@@ -173,45 +302,373 @@ static void set_target_clock_speed(uint8_t speed)
     write_single_debug_byte(reg_swire_clk_div, speed);
 }
 
+void set_tx_clock(double clock_hz)
+{
+    sws_tx_program_init(pio0, SM_TX, sws_tx_program_offset, SWS_PIN, clock_hz);
+    pio_sm_set_enabled(pio0, SM_TX, true);
+}
+
 static void banner()
 {
     printf(
         "# Telink debugger bridge\n"
         "# Commands:\n"
         "# i            verify connection to device\n"
+        "# aX           attach to running device; X=1 to also halt it\n"
         "# rX           X=[0, 1] set status of reset pin\n"
         "# g            take device out of reset\n"
-        "# s            read device socid\n"
-        "# RXXXXYYYY    read YYYY bytes from XXXX (values in hex)\n"
-        "# WXXXXYYYY... write YYYY bytes to XXXX, folowed by hex pairs\n"
+        "# s            read device socid from the chip\n"
+        "# p            read profile of connected device\n"
+        "# RXXXXXXXXYYYYYYYY     read YYYYYYYY bytes from XXXXXXXX (values in "
+        "hex)\n"
+        "# WXXXXXXXXYYYYYYYY...  write YYYYYYYY bytes to XXXXXXXX, folowed by "
+        "hex pairs\n"
+        "# uX           X=[0, 1] capture UART while the data port is closed\n"
+        "# bXXXXXXXX    set the UART baud rate to XXXXXXXX (in hex)\n"
+        "# fTXXXXXXXXYYYYYYYYNN...  search YYYYYYYY bytes from XXXXXXXX in\n"
+        "#              T=[r, f] RAM or flash for an NN byte pattern, followed\n"
+        "#              by NN pattern and NN mask hex pairs\n"
+        "# CXXXXXXXX    start capturing the SWS pins at XXXXXXXX Hz\n"
+        "# c            stop capturing and send the edges\n"
         "# Responses are S for success, E for error, and # is a comment.\n"
         "# Good luck (you'll need it).\n");
+    printf("# System clock: %lu kHz\n", clock_get_hz(clk_sys) / 1000);
+    if (clock_warning)
+        printf("# Warning: %s\n", clock_warning);
+}
+
+/* Nothing is written until the SoC ID matches. A read with too few address
+ * bytes is harmless to a chip expecting more (it's abandoned when the
+ * terminator arrives), but the reverse looks like a write, so the profiles
+ * must be in order of increasing address width. */
+
+static bool probe_profile(const soc_profile_t* profile, bool halt)
+{
+    current_profile = profile;
+    uint16_t socid = read_single_debug_word(reg_soc_id);
+    if (socid != profile->socid)
+        return false;
+
+    if (halt)
+        halt_target();
+    return true;
+}
+
+/* Asks the flash chip how big it is. The last byte of the JEDEC ID is the log2
+ * of the size on nearly every part. This is only done with the target halted,
+ * as the chip may be busy running code out of the flash. */
+
+static void probe_flash(bool halt)
+{
+    current_flash.flash_size = current_profile->flash_size;
+    current_flash.calibration_address = current_profile->calibration_address;
+    if (!halt)
+    {
+        printf("# not halted; assuming %lu kB flash\n",
+            current_flash.flash_size / 1024);
+        return;
+    }
+
+    flash_select(true);
+    flash_send(0x9f); /* read JEDEC ID command */
+    uint8_t manufacturer = flash_receive();
+    uint8_t type = flash_receive();
+    uint8_t capacity = flash_receive();
+    flash_select(false);
+    printf("# flash JEDEC ID %02x%02x%02x\n", manufacturer, type, capacity);
+
+    uint32_t size = (capacity < 32) ? (1U << capacity) : 0;
+    for (unsigned i = 0; i < NUM_FLASH_LAYOUTS; i++)
+    {
+        if (flash_layouts[i].flash_size == size)
+        {
+            current_flash = flash_layouts[i];
+            printf("# %lu kB flash\n", current_flash.flash_size / 1024);
+            return;
+        }
+    }
+
+    printf("# unknown flash; assuming %lu kB\n",
+        current_flash.flash_size / 1024);
+}
+
+static bool probe_target(bool halt)
+{
+    /* Always start off slow; we don't know what state the target's SWS
+     * divider is in. */
+
+    set_tx_clock(SWS_PROBE_CLOCK_HZ);
+
+    for (unsigned i = 0; i < NUM_SOC_PROFILES; i++)
+    {
+        const soc_profile_t* profile = &soc_profiles[i];
+        if (probe_profile(profile, halt))
+        {
+            printf("# found %s\n", profile->name);
+            is_connected = true;
+
+            /* Disable the watchdog timer, unless the target's own code is
+             * still running and looking after it. */
+
+            if (halt)
+                write_single_debug_quad(reg_tmr_ctl, 0);
+
+            /* Switch to the fastest SWS settings this chip supports. */
+
+            if (profile->swire_clk_div)
+                set_target_clock_speed(profile->swire_clk_div);
+            set_tx_clock(profile->sws_clock_hz);
+
+            probe_flash(halt);
+            return true;
+        }
+    }
+
+    current_profile = &soc_profiles[0];
+    return false;
 }
 
 static void init_cmd()
 {
     printf("# init\n");
+    is_connected = false;
 
     gpio_put(RST_PIN, false);
-    sleep_ms(20);
+    sleep_ms(TARGET_BOOT_MS);
     gpio_put(RST_PIN, true);
-    sleep_ms(20);
+    sleep_ms(TARGET_BOOT_MS);
 
-    halt_target();
+    if (probe_target(true))
+        printf("S\n");
+    else
+        printf("E\n# init failed\n");
+}
 
-    uint16_t socid = read_single_debug_word(reg_soc_id);
-    if (socid == 0x5316)
+static void attach_cmd(bool halt)
+{
+    printf("# attach\n");
+
+    /* If the previous session is still good, carry on using it. */
+
+    if (is_connected &&
+        (read_single_debug_word(reg_soc_id) == current_profile->socid))
     {
+        printf("# resuming session with %s\n", current_profile->name);
+        if (halt)
+        {
+            halt_target();
+            write_single_debug_quad(reg_tmr_ctl, 0);
+        }
+        printf("S\n");
+        return;
+    }
+
+    /* Otherwise, sync up with the target as it is, without resetting it. If
+     * we were holding it in reset there's nothing running to attach to, so
+     * let it go and give it time to boot first. */
+
+    is_connected = false;
+    if (!gpio_get_out_level(RST_PIN))
+    {
+        printf("# releasing reset\n");
+        gpio_put(RST_PIN, true);
+        sleep_ms(TARGET_BOOT_MS);
+    }
+
+    if (probe_target(halt))
         printf("S\n");
-        is_connected = true;
+    else
+        printf("E\n# attach failed\n");
+}
+
+static void profile_cmd()
+{
+    if (!is_connected)
+    {
+        printf("E\n# not connected\n");
+        return;
+    }
+
+    /* The client needs all of this to drive the flash controller, so it's
+     * sent as a single hex record rather than as comments. */
+
+    const soc_profile_t* profile = current_profile;
+    printf("# %s\n", profile->name);
+    printf("%08lx%08lx%08lx%08lx%08lx%08lx%08lx%08lx\n",
+        (uint32_t)profile->socid,
+        profile->ram_start,
+        profile->ram_size,
+        current_flash.flash_size,
+        current_flash.calibration_address,
+        reg_spi_data,
+        reg_spi_ctrl,
+        reg_swire_id);
+    printf("S\n");
+}
+
+static uint32_t stop_capture()
+{
+    pio_sm_set_enabled(pio0, SM_CAPTURE, false);
+    uint32_t remaining =
+        dma_channel_hw_addr(capture_dma_channel)->transfer_count;
+    dma_channel_abort(capture_dma_channel);
+    is_capturing = false;
+
+    return (CAPTURE_BUFFER_WORDS - remaining) * CAPTURE_SAMPLES_PER_WORD;
+}
 
-        /* Disable the watchdog timer. */
+static void start_capture_cmd(uint32_t sample_hz)
+{
+    if (is_capturing)
+        stop_capture();
 
-        write_single_debug_quad(reg_tmr_ctl, 0);
+    uint32_t sysclock_hz = clock_get_hz(clk_sys);
+    if ((sample_hz == 0) || (sample_hz > sysclock_hz) ||
+        ((sysclock_hz / sample_hz) > 65535))
+    {
+        printf("E\n# bad sample rate\n");
         return;
     }
 
-    printf("E\n# init failed\n");
+    sws_capture_program_init(pio0,
+        SM_CAPTURE,
+        sws_capture_program_offset,
+        SWS_PIN,
+        sample_hz);
+    pio_sm_clear_fifos(pio0, SM_CAPTURE);
+
+    dma_channel_config c = dma_channel_get_default_config(capture_dma_channel);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_dreq(&c, pio_get_dreq(pio0, SM_CAPTURE, false));
+    dma_channel_configure(capture_dma_channel,
+        &c,
+        capture_buffer,
+        &pio0->rxf[SM_CAPTURE],
+        CAPTURE_BUFFER_WORDS,
+        true);
+
+    pio_sm_set_enabled(pio0, SM_CAPTURE, true);
+    is_capturing = true;
+    printf("S\n");
+}
+
+static uint8_t get_capture_sample(uint32_t index)
+{
+    uint32_t word = capture_buffer[index / CAPTURE_SAMPLES_PER_WORD];
+    return (word >> ((index % CAPTURE_SAMPLES_PER_WORD) * 4)) & 0x0f;
+}
+
+static void stop_capture_cmd()
+{
+    if (!is_capturing)
+    {
+        printf("E\n# not capturing\n");
+        return;
+    }
+
+    /* Send only the transitions, as (sample index, pin state) records; the
+     * final sample is always sent so the host knows the length. */
+
+    uint32_t count = stop_capture();
+    printf("# %lu samples\n", count);
+    if (count == (CAPTURE_BUFFER_WORDS * CAPTURE_SAMPLES_PER_WORD))
+        printf("# buffer filled before capture stopped\n");
+
+    uint8_t last = 0xff;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint8_t sample = get_capture_sample(i);
+        if ((sample != last) || (i == (count - 1)))
+            printf("%08lx%02x\n", i, sample);
+        last = sample;
+    }
+    printf("S\n");
+}
+
+/* A shift-and matcher: bit n of the state is set if the last n+1 bytes
+ * matched the first n+1 bytes of the pattern, so each byte costs one shift
+ * and one table lookup regardless of pattern length. */
+
+static void build_search_table(
+    const uint8_t* pattern, const uint8_t* mask, int length)
+{
+    for (int c = 0; c < 256; c++)
+    {
+        uint32_t bits = 0;
+        for (int i = 0; i < length; i++)
+        {
+            if (((c ^ pattern[i]) & mask[i]) == 0)
+                bits |= 1U << i;
+        }
+        search_table[c] = bits;
+    }
+}
+
+static void search_cmd(bool flash,
+    uint32_t address,
+    uint32_t count,
+    const uint8_t* pattern,
+    const uint8_t* mask,
+    int length)
+{
+    if (!is_connected)
+    {
+        printf("E\n# not connected\n");
+        return;
+    }
+    if ((length < 1) || (length > SEARCH_PATTERN_MAX))
+    {
+        printf("E\n# bad pattern length\n");
+        return;
+    }
+
+    build_search_table(pattern, mask, length);
+    uint32_t state = 0;
+    uint32_t found = 1U << (length - 1);
+    int matches = 0;
+
+    if (flash)
+    {
+        flash_select(true);
+        flash_send(0x03); /* read flash command */
+        flash_send(address >> 16);
+        flash_send(address >> 8);
+        flash_send(address);
+        write_single_debug_byte(reg_swire_id, 0x80); /* SWS to FIFO mode */
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint8_t b;
+        if (flash)
+            b = flash_receive();
+        else if (i == 0)
+            b = read_first_debug_byte(address);
+        else
+            b = read_next_debug_byte();
+
+        state = ((state << 1) | 1) & search_table[b];
+        if (state & found)
+        {
+            printf("%08lx\n", address + i + 1 - length);
+            if (++matches == SEARCH_MATCHES_MAX)
+            {
+                printf("# too many matches\n");
+                break;
+            }
+        }
+    }
+
+    if (flash)
+    {
+        write_single_debug_byte(reg_swire_id, 0x00); /* SWS to RAM mode */
+        flash_select(false);
+    }
+    else if (count)
+        finish_reading_debug_bytes();
+
+    printf("S\n");
 }
 
 static uint8_t read_hex_byte()
@@ -230,35 +687,100 @@ static uint16_t read_hex_word()
     return lo | (hi << 8);
 }
 
-void set_tx_clock(double clock_hz)
+static uint32_t read_hex_quad()
 {
-    sws_tx_program_init(pio0, SM_TX, sws_tx_program_offset, SWS_PIN, clock_hz);
-    pio_sm_set_enabled(pio0, SM_TX, true);
+    uint16_t hi = read_hex_word();
+    uint16_t lo = read_hex_word();
+    return lo | ((uint32_t)hi << 16);
+}
+
+static bool tx_divider_in_range(double sysclock_hz, double clock_hz)
+{
+    double divider = sysclock_hz / clock_hz;
+    return (divider >= 1.0) && (divider < 65536.0);
+}
+
+static bool clock_self_test()
+{
+    /* Check the clock against the crystal, in case the PLL is lying. */
+
+    uint32_t expected_khz = clock_get_hz(clk_sys) / 1000;
+    uint32_t measured_khz = frequency_count_khz(CLOCKS_FC0_SRC_VALUE_CLK_SYS);
+    if ((measured_khz < (expected_khz * 99 / 100)) ||
+        (measured_khz > (expected_khz * 101 / 100)))
+        return false;
+
+    /* The sws_rx delay loops only come in steps of eight cycles, so make
+     * sure they still add up to roughly the right time. */
+
+    double sysclock_hz = clock_get_hz(clk_sys);
+    double delay_ns =
+        (sws_rx_delay_count(SWS_RX_DELAY_NS) + 1) * 8 * 1.0e9 / sysclock_hz;
+    if ((delay_ns < (SWS_RX_DELAY_NS * 0.9)) ||
+        (delay_ns > (SWS_RX_DELAY_NS * 1.1)))
+        return false;
+
+    /* Every SWS clock we might use must be reachable with the PIO divider,
+     * which goes from 1 to 65536. */
+
+    if (!tx_divider_in_range(sysclock_hz, SWS_PROBE_CLOCK_HZ))
+        return false;
+    for (unsigned i = 0; i < NUM_SOC_PROFILES; i++)
+    {
+        if (!tx_divider_in_range(sysclock_hz, soc_profiles[i].sws_clock_hz))
+            return false;
+    }
+
+    return true;
+}
+
+static void init_clocks()
+{
+#if SYS_CLOCK_KHZ > 200000
+    vreg_set_voltage(VREG_VOLTAGE_1_15);
+    busy_wait_ms(10);
+#endif
+
+    if (set_sys_clock_khz(SYS_CLOCK_KHZ, false) && clock_self_test())
+        return;
+
+    set_sys_clock_khz(STOCK_SYS_CLOCK_KHZ, true);
+    vreg_set_voltage(VREG_VOLTAGE_DEFAULT);
+    clock_warning = "clock self test failed; running at stock speed";
 }
 
 int main(void)
 {
+    init_clocks();
     usb_bridge_init();
     stdio_queue_init();
 
+    /* The level is set before the pin becomes an output so that, if we're
+     * not resetting the target, it never sees a glitch. */
+
     gpio_init(RST_PIN);
+    gpio_put(RST_PIN, !RESET_AT_BOOT);
     gpio_set_dir(RST_PIN, true);
-    gpio_put(RST_PIN, false);
 
     gpio_set_pulls(RST_PIN, false, false);
     gpio_set_pulls(SWS_PIN, true, false);
     gpio_set_pulls(DBG_PIN, false, false);
 
     sws_tx_program_offset = pio_add_program(pio0, &sws_tx_program);
-    set_tx_clock(10.0e6);
+    set_tx_clock(SWS_PROBE_CLOCK_HZ);
 
     sws_rx_program_offset = pio_add_program(pio1, &sws_rx_program);
-    sws_rx_program_init(pio1, SM_RX, sws_rx_program_offset, SWS_PIN);
+    sws_rx_program_init(
+        pio1, SM_RX, sws_rx_program_offset, SWS_PIN, SWS_RX_DELAY_NS);
     pio_sm_set_enabled(pio1, SM_RX, true);
 
+    sws_capture_program_offset = pio_add_program(pio0, &sws_capture_program);
+    capture_dma_channel = dma_claim_unused_channel(true);
+
     banner();
     for (;;)
     {
+        command_idle = true;
         int c = getchar();
         switch (c)
         {
@@ -277,8 +799,13 @@ int main(void)
                 break;
             }
 
+            case 'a':
+                attach_cmd(getchar() == '1');
+                break;
+
             case 'g':
             {
+                is_connected = false;
                 gpio_put(RST_PIN, 0);
                 sleep_us(100);
                 gpio_put(RST_PIN, 1);
@@ -286,17 +813,21 @@ int main(void)
                 break;
             }
 
+            case 'p':
+                profile_cmd();
+                break;
+
             case 's':
             {
                 uint16_t socid = read_single_debug_word(reg_soc_id);
-                printf("# socid = %04x\nS\n", socid);
+                printf("%04x\nS\n", socid);
                 break;
             }
 
             case 'R':
             {
-                uint16_t address = read_hex_word();
-                uint16_t count = read_hex_word();
+                uint32_t address = read_hex_quad();
+                uint32_t count = read_hex_quad();
 
                 if (count)
                 {
@@ -319,8 +850,8 @@ int main(void)
 
             case 'W':
             {
-                uint16_t address = read_hex_word();
-                uint16_t count = read_hex_word();
+                uint32_t address = read_hex_quad();
+                uint32_t count = read_hex_quad();
 
                 if (count)
                 {
@@ -341,6 +872,63 @@ int main(void)
                 break;
             }
 
+            case 'u':
+            {
+                int i = getchar() == '1';
+                printf("# uart capture <- %d\n", i);
+                uart_capture_enabled = i;
+                printf("S\n");
+                break;
+            }
+
+            case 'b':
+            {
+                uint32_t baud = read_hex_quad();
+                if (!baud)
+                {
+                    printf("E\n# bad baud rate\n");
+                    break;
+                }
+                printf("# uart baud rate <- %lu\n", baud);
+                uart_set_baud_rate(baud);
+                printf("S\n");
+                break;
+            }
+
+            case 'f':
+            {
+                bool flash = getchar() == 'f';
+                uint32_t address = read_hex_quad();
+                uint32_t count = read_hex_quad();
+                int length = read_hex_byte();
+
+                uint8_t pattern[SEARCH_PATTERN_MAX];
+                uint8_t mask[SEARCH_PATTERN_MAX];
+                for (int i = 0; i < length; i++)
+                {
+                    uint8_t b = read_hex_byte();
+                    if (i < SEARCH_PATTERN_MAX)
+                        pattern[i] = b;
+                }
+                for (int i = 0; i < length; i++)
+                {
+                    uint8_t b = read_hex_byte();
+                    if (i < SEARCH_PATTERN_MAX)
+                        mask[i] = b;
+                }
+
+                search_cmd(flash, address, count, pattern, mask, length);
+                break;
+            }
+
+            case 'C':
+                start_capture_cmd(read_hex_quad());
+                break;
+
+            case 'c':
+                stop_capture_cmd();
+                break;
+
             case '?':
                 banner();
                 break;
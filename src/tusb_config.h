@@ -18,6 +18,15 @@
 #define CFG_TUD_CDC_RX_BUFSIZE 1024
 #define CFG_TUD_CDC_TX_BUFSIZE 1024
 
+/* A raw bulk alternative to the control port, for use via libusb. The large
+ * FIFOs let the endpoints be rearmed while earlier packets are still being
+ * processed. */
+
+#define CFG_TUD_VENDOR 1
+#define CFG_TUD_VENDOR_EPSIZE 64
+#define CFG_TUD_VENDOR_RX_BUFSIZE 4096
+#define CFG_TUD_VENDOR_TX_BUFSIZE 4096
+
 extern void usbd_serial_init(void);
 
 #endif /* _TUSB_CONFIG_H_ */
@@ -18,12 +18,15 @@
 #define USBD_VID 0x2E8A /* Raspberry Pi */
 #define USBD_PID 0x000A /* Raspberry Pi Pico SDK CDC */
 
-#define USBD_DESC_LEN (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN * CFG_TUD_CDC)
+#define USBD_DESC_LEN                                                          \
+    (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN * CFG_TUD_CDC +                    \
+        TUD_VENDOR_DESC_LEN * CFG_TUD_VENDOR)
 #define USBD_MAX_POWER_MA 500
 
 #define USBD_ITF_CDC_0 0
 #define USBD_ITF_CDC_1 2
-#define USBD_ITF_MAX 4
+#define USBD_ITF_VENDOR 4
+#define USBD_ITF_MAX 5
 
 #define USBD_CDC_0_EP_CMD 0x81
 #define USBD_CDC_1_EP_CMD 0x83
@@ -34,8 +37,12 @@
 #define USBD_CDC_0_EP_IN 0x82
 #define USBD_CDC_1_EP_IN 0x84
 
+#define USBD_VENDOR_EP_OUT 0x05
+#define USBD_VENDOR_EP_IN 0x85
+
 #define USBD_CDC_CMD_MAX_SIZE 8
 #define USBD_CDC_IN_OUT_MAX_SIZE 64
+#define USBD_VENDOR_IN_OUT_MAX_SIZE 64
 
 #define USBD_STR_0 0x00
 #define USBD_STR_MANUF 0x01
@@ -43,6 +50,7 @@
 #define USBD_STR_SERIAL 0x03
 #define USBD_STR_SERIAL_LEN 17
 #define USBD_STR_CDC 0x04
+#define USBD_STR_VENDOR 0x05
 
 static const tusb_desc_device_t usbd_desc_device = {
     .bLength = sizeof(tusb_desc_device_t),
@@ -84,6 +92,12 @@ static const uint8_t usbd_desc_cfg[USBD_DESC_LEN] = {
         USBD_CDC_1_EP_OUT,
         USBD_CDC_1_EP_IN,
         USBD_CDC_IN_OUT_MAX_SIZE),
+
+    TUD_VENDOR_DESCRIPTOR(USBD_ITF_VENDOR,
+        USBD_STR_VENDOR,
+        USBD_VENDOR_EP_OUT,
+        USBD_VENDOR_EP_IN,
+        USBD_VENDOR_IN_OUT_MAX_SIZE),
 };
 
 static char usbd_serial[USBD_STR_SERIAL_LEN] = "000000000000";
@@ -94,6 +108,7 @@ static const char* const usbd_desc_str[] = {
     [USBD_STR_PRODUCT] = "Telink debugger bridge",
     [USBD_STR_SERIAL] = usbd_serial,
     [USBD_STR_CDC] = "Board CDC",
+    [USBD_STR_VENDOR] = "Board bulk control",
 };
 
 const uint8_t* tud_descriptor_device_cb(void)
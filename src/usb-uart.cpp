@@ -4,7 +4,9 @@
  * Copyright 2021 Álvaro Fernández Rojas <noltari@gmail.com>
  */
 
+#include <hardware/irq.h>
 #include <hardware/structs/sio.h>
+#include <hardware/sync.h>
 #include <hardware/uart.h>
 #include <pico/multicore.h>
 #include <pico/stdlib.h>
@@ -29,6 +31,20 @@
 #define IF_CONTROL 0
 #define IF_DATA 1
 
+/* While nobody is listening on the data port, received bytes go into a
+ * timestamped ring instead, which is replayed when the port is opened. */
+
+#define CAPTURE_SIZE 16384
+#define CAPTURE_FRAME_GAP_US 100
+#define CAPTURE_FRAME_MAX 32
+#define CAPTURE_FRAME_TEXT_MAX (10 + CAPTURE_FRAME_MAX * 2 + 1)
+
+/* Bytes are timestamped as they're taken out of the UART FIFO by the receive
+ * interrupt, and handed to the main loop through this ring. Must be a power
+ * of two. */
+
+#define RX_RING_SIZE 1024
+
 typedef struct
 {
     uart_inst_t* const inst;
@@ -46,6 +62,34 @@ typedef struct
     uint32_t usb_pos;
 } uart_data_t;
 
+typedef struct
+{
+    uint32_t time_us[CAPTURE_SIZE];
+    uint8_t data[CAPTURE_SIZE];
+    uint32_t head;
+    uint32_t count;
+    uint32_t dropped;
+    bool replaying;
+} capture_t;
+
+typedef struct
+{
+    uint32_t time_us[RX_RING_SIZE];
+    uint8_t data[RX_RING_SIZE];
+    volatile uint32_t head; /* only written by the interrupt handler */
+    volatile uint32_t tail; /* only written by the main loop */
+} rx_ring_t;
+
+typedef struct
+{
+    uint8_t usb_buffer[BUFFER_SIZE];
+    uint32_t usb_pos;
+    uint8_t fifo_buffer[BUFFER_SIZE];
+    uint32_t fifo_pos;
+    bool active;
+} vendor_data_t;
+
+static void uart_rx_irq(void);
 static void uart_read_bytes(uint8_t itf);
 static void uart_write_bytes(uint8_t itf);
 static void fifo_read_bytes(uint8_t itf);
@@ -64,6 +108,17 @@ static const uart_id_t UART_ID[CFG_TUD_CDC] = {
 };
 
 static uart_data_t UART_DATA[CFG_TUD_CDC];
+static capture_t capture;
+static rx_ring_t rx_ring;
+static vendor_data_t VENDOR_DATA;
+
+volatile bool uart_capture_enabled = true;
+
+/* Baud rate changes asked for by the control port; the sequence number lets
+ * core1 spot a repeated request for the same rate. */
+
+static volatile uint32_t requested_baud;
+static volatile uint32_t requested_baud_seq;
 
 queue_t rd_queue;
 queue_t wr_queue;
@@ -132,6 +187,27 @@ static void update_uart_cfg(uint8_t itf)
     }
 }
 
+/* Called from core0. A host opening the data port will override this with its
+ * own line coding. */
+
+void uart_set_baud_rate(uint32_t baud)
+{
+    requested_baud = baud;
+    __dmb();
+    requested_baud_seq++;
+}
+
+static void apply_requested_baud(void)
+{
+    static uint32_t seq;
+
+    if (seq == requested_baud_seq)
+        return;
+    seq = requested_baud_seq;
+    __dmb();
+    UART_DATA[IF_DATA].usb_lc.bit_rate = requested_baud;
+}
+
 static void usb_read_bytes(uint8_t itf)
 {
     uart_data_t* ud = &UART_DATA[itf];
@@ -169,6 +245,92 @@ static void usb_write_bytes(uint8_t itf)
     }
 }
 
+static uint32_t capture_index(uint32_t offset)
+{
+    return (capture.head - capture.count + offset) % CAPTURE_SIZE;
+}
+
+static void capture_add(uint32_t time_us, uint8_t byte)
+{
+    if (capture.count == CAPTURE_SIZE)
+    {
+        /* Full; lose the oldest byte. */
+        capture.count--;
+        capture.dropped++;
+    }
+
+    capture.time_us[capture.head] = time_us;
+    capture.data[capture.head] = byte;
+    capture.head = (capture.head + 1) % CAPTURE_SIZE;
+    capture.count++;
+}
+
+static void capture_append(uart_data_t* ud, const char* s, uint32_t len)
+{
+    memcpy(&ud->uart_buffer[ud->uart_pos], s, len);
+    ud->uart_pos += len;
+}
+
+/* Replays the ring as text frames of the form '@tttttttt:xxxx...', where t is
+ * the arrival time of the first byte in microseconds and x are the bytes. A
+ * frame is a run of bytes each arriving within CAPTURE_FRAME_GAP_US of the
+ * previous one. */
+
+static void capture_replay(uint8_t itf)
+{
+    uart_data_t* ud = &UART_DATA[itf];
+    char text[CAPTURE_FRAME_TEXT_MAX + 1];
+    int len;
+
+    if (!capture.replaying)
+    {
+        if (!capture.count)
+            return;
+
+        len = snprintf(text,
+            sizeof(text),
+            "\n# uart capture: %lu bytes, %lu dropped\n",
+            capture.count,
+            capture.dropped);
+        if (len > (BUFFER_SIZE - ud->uart_pos))
+            return;
+        capture_append(ud, text, len);
+        capture.replaying = true;
+        capture.dropped = 0;
+    }
+
+    while (capture.count &&
+           ((BUFFER_SIZE - ud->uart_pos) >= CAPTURE_FRAME_TEXT_MAX))
+    {
+        uint32_t i = capture_index(0);
+        uint32_t then = capture.time_us[i];
+        len = snprintf(text, sizeof(text), "@%08lx:", then);
+
+        for (int n = 0; capture.count && (n < CAPTURE_FRAME_MAX); n++)
+        {
+            i = capture_index(0);
+            if ((capture.time_us[i] - then) > CAPTURE_FRAME_GAP_US)
+                break;
+
+            len += snprintf(
+                text + len, sizeof(text) - len, "%02x", capture.data[i]);
+            then = capture.time_us[i];
+            capture.count--;
+        }
+
+        text[len++] = '\n';
+        capture_append(ud, text, len);
+    }
+
+    if (!capture.count &&
+        ((BUFFER_SIZE - ud->uart_pos) >= CAPTURE_FRAME_TEXT_MAX))
+    {
+        static const char end[] = "# end of capture\n";
+        capture_append(ud, end, sizeof(end) - 1);
+        capture.replaying = false;
+    }
+}
+
 static void usb_cdc_process(uint8_t itf)
 {
     uart_data_t* ud = &UART_DATA[itf];
@@ -179,10 +341,99 @@ static void usb_cdc_process(uint8_t itf)
     usb_write_bytes(itf);
 }
 
+static void vendor_process(void)
+{
+    vendor_data_t* vd = &VENDOR_DATA;
+
+    /* USB to the command queue */
+
+    uint32_t len = MIN(tud_vendor_available(), BUFFER_SIZE - vd->usb_pos);
+    if (len)
+    {
+        uint32_t count = tud_vendor_read(&vd->usb_buffer[vd->usb_pos], len);
+        vd->usb_pos += count;
+    }
+
+    if (vd->active && vd->usb_pos)
+    {
+        uint32_t count = 0;
+        while (count < vd->usb_pos)
+        {
+            if (!queue_try_add(&rd_queue, &vd->usb_buffer[count]))
+                break;
+            count++;
+        }
+
+        if (count < vd->usb_pos)
+            memmove(
+                vd->usb_buffer, &vd->usb_buffer[count], vd->usb_pos - count);
+        vd->usb_pos -= count;
+    }
+
+    /* Responses back to USB. Anything already buffered is still sent even
+     * after losing control, as it's the reply to our own commands. */
+
+    while (vd->active && (vd->fifo_pos < BUFFER_SIZE))
+    {
+        if (!queue_try_remove(&wr_queue, &vd->fifo_buffer[vd->fifo_pos]))
+            break;
+        vd->fifo_pos++;
+    }
+
+    if (vd->fifo_pos)
+    {
+        uint32_t count = tud_vendor_write(vd->fifo_buffer, vd->fifo_pos);
+        if (count < vd->fifo_pos)
+            memmove(vd->fifo_buffer,
+                &vd->fifo_buffer[count],
+                vd->fifo_pos - count);
+        vd->fifo_pos -= count;
+
+        if (count)
+            tud_vendor_write_flush();
+    }
+}
+
+/* Commands come from either the control port or the vendor interface, and
+ * responses go back to wherever the command came from. Control only changes
+ * hands when core0 is waiting for a new command and all its output has been
+ * collected, so a response can never be split between the two. Anything the
+ * new owner still has buffered from its previous turn was never read, so it's
+ * discarded rather than being sent ahead of the new replies. */
+
+static void update_owner(void)
+{
+    vendor_data_t* vd = &VENDOR_DATA;
+    uart_data_t* ud = &UART_DATA[IF_CONTROL];
+
+    uint32_t ours = vd->active ? vd->usb_pos : ud->usb_pos;
+    uint32_t theirs = vd->active ? ud->usb_pos : vd->usb_pos;
+    if (ours || !theirs)
+        return;
+    if (!queue_is_empty(&rd_queue) || !queue_is_empty(&wr_queue) ||
+        !command_idle)
+        return;
+
+    vd->active = !vd->active;
+    if (vd->active)
+        vd->fifo_pos = 0;
+    else
+        ud->uart_pos = 0;
+}
+
 static void core1_entry(void)
 {
     tusb_init();
 
+    /* Interrupts are taken by the core which enables them, so this has to
+     * happen here rather than in init_uart_data(). */
+
+    uart_inst_t* inst = UART_ID[IF_DATA].inst;
+    uint irq = UART0_IRQ + uart_get_index(inst);
+    irq_set_exclusive_handler(irq, uart_rx_irq);
+    irq_set_enabled(irq, true);
+    uart_set_irq_enables(inst, true, false);
+
     while (1)
     {
         int itf;
@@ -197,31 +448,86 @@ static void core1_entry(void)
             if (tud_cdc_n_connected(itf))
             {
                 con = 1;
+                if (itf == IF_DATA)
+                    capture_replay(itf);
                 usb_cdc_process(itf);
             }
 
             /* Send/receive UARTs */
 
+            apply_requested_baud();
             update_uart_cfg(IF_DATA);
             uart_read_bytes(IF_DATA);
             uart_write_bytes(IF_DATA);
 
-            fifo_read_bytes(IF_CONTROL);
-            fifo_write_bytes(IF_CONTROL);
+            if (!VENDOR_DATA.active)
+            {
+                fifo_read_bytes(IF_CONTROL);
+                fifo_write_bytes(IF_CONTROL);
+            }
         }
 
+        if (tud_vendor_mounted())
+            vendor_process();
+        update_owner();
+
         gpio_put(LED_PIN, con);
     }
 }
 
+static void uart_rx_irq(void)
+{
+    uart_inst_t* inst = UART_ID[IF_DATA].inst;
+    uint32_t now = time_us_32();
+
+    while (uart_is_readable(inst))
+    {
+        uint8_t byte = uart_getc(inst);
+        uint32_t head = rx_ring.head;
+        if ((head - rx_ring.tail) == RX_RING_SIZE)
+            continue; /* full; the main loop has fallen behind */
+
+        rx_ring.time_us[head % RX_RING_SIZE] = now;
+        rx_ring.data[head % RX_RING_SIZE] = byte;
+        __dmb();
+        rx_ring.head = head + 1;
+    }
+}
+
+static bool rx_ring_get(uint32_t* time_us, uint8_t* byte)
+{
+    uint32_t tail = rx_ring.tail;
+    if (tail == rx_ring.head)
+        return false;
+
+    __dmb();
+    *time_us = rx_ring.time_us[tail % RX_RING_SIZE];
+    *byte = rx_ring.data[tail % RX_RING_SIZE];
+    __dmb();
+    rx_ring.tail = tail + 1;
+    return true;
+}
+
 static void uart_read_bytes(uint8_t itf)
 {
     uart_data_t* ud = &UART_DATA[itf];
-    const uart_id_t* ui = &UART_ID[itf];
+    uint32_t time_us;
+    uint8_t byte;
+
+    /* Until any backlog has been replayed, keep capturing so that nothing
+     * arrives out of order. */
+
+    if ((uart_capture_enabled && !tud_cdc_n_connected(itf)) ||
+        capture.count || capture.replaying)
+    {
+        while (rx_ring_get(&time_us, &byte))
+            capture_add(time_us, byte);
+        return;
+    }
 
-    while (uart_is_readable(ui->inst) && (ud->uart_pos < BUFFER_SIZE))
+    while ((ud->uart_pos < BUFFER_SIZE) && rx_ring_get(&time_us, &byte))
     {
-        ud->uart_buffer[ud->uart_pos] = uart_getc(ui->inst);
+        ud->uart_buffer[ud->uart_pos] = byte;
         ud->uart_pos++;
     }
 }
@@ -330,7 +636,7 @@ void usb_bridge_init(void)
     for (int itf = 0; itf < CFG_TUD_CDC; itf++)
         init_uart_data(itf);
 
-    queue_init(&rd_queue, 1, 256);
-    queue_init(&wr_queue, 1, 256);
+    queue_init(&rd_queue, 1, 1024);
+    queue_init(&wr_queue, 1, 1024);
     multicore_launch_core1(core1_entry);
 }